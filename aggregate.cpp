@@ -0,0 +1,108 @@
+#include "aggregate.h"
+#include "latency.h"
+
+static Aggregate agg[AGG_WINDOWS][SENSOR_NUM];
+static uint32_t agg_window_nr[AGG_WINDOWS];
+static uint16_t agg_minutes[AGG_WINDOWS];  /* window length the accumulators were collected for */
+static bool agg_wall[AGG_WINDOWS];          /* agg_window_nr counts wall clock windows */
+
+/* number of the current window: of wall clock time once it is set, so hours end on the full hour */
+static uint32_t window_nr(int w, bool &wall)
+{
+    uint32_t len = agg_minutes[w] * 60;
+    wall = wallclock_ok();
+    if (!wall)
+        return uptime_sec() / len;
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec / len;
+}
+
+/* the window length was changed or the window disabled: start over */
+static void check_length(int w)
+{
+    if (agg_minutes[w] == config.agg_minutes[w])
+        return;
+    agg_minutes[w] = config.agg_minutes[w];
+    memset(agg[w], 0, sizeof(agg[w]));
+    if (agg_minutes[w] != 0)
+        agg_window_nr[w] = window_nr(w, agg_wall[w]);
+}
+
+void agg_update(SensorFrame *f, bool temp_ok, bool humi_ok)
+{
+    int16_t t = (int16_t)lroundf(f->temp * 10);
+    for (int w = 0; w < AGG_WINDOWS; w++) {
+        check_length(w);
+        if (agg_minutes[w] == 0)
+            continue;
+        Aggregate *a = &agg[w][f->ID];
+        if (temp_ok) {
+            if (a->count == 0 || t < a->t_min)
+                a->t_min = t;
+            if (a->count == 0 || t > a->t_max)
+                a->t_max = t;
+            a->t_sum += t;
+            a->count++;
+        }
+        if (humi_ok && f->humi > 0 && f->humi <= 100) {
+            if (a->h_count == 0 || f->humi < a->h_min)
+                a->h_min = f->humi;
+            if (a->h_count == 0 || f->humi > a->h_max)
+                a->h_max = f->humi;
+            a->h_sum += f->humi;
+            a->h_count++;
+        }
+    }
+}
+
+/* true once per window, when a window boundary has been crossed */
+bool agg_window_due(int w)
+{
+    check_length(w);
+    if (agg_minutes[w] == 0)
+        return false;
+    bool wall;
+    uint32_t nr = window_nr(w, wall);
+    if (wall != agg_wall[w]) {
+        /* the clock was just set: this window runs on until the next wall clock boundary */
+        agg_wall[w] = wall;
+        agg_window_nr[w] = nr;
+        return false;
+    }
+    if (nr == agg_window_nr[w])
+        return false;
+    agg_window_nr[w] = nr;
+    return true;
+}
+
+/* build the summary message for sensor ID, returns false if nothing was received */
+bool agg_render(int w, int ID, String &topic_suffix, JsonDocument &json)
+{
+    Aggregate *a = &agg[w][ID];
+    if (a->count == 0 && a->h_count == 0)
+        return false;
+    uint16_t m = config.agg_minutes[w];
+    if (m % 60 == 0)
+        topic_suffix = "agg/" + String(m / 60) + "h";
+    else
+        topic_suffix = "agg/" + String(m) + "m";
+    if (a->count > 0) {
+        json["temp_min"] = serialized(String(a->t_min / 10.0, 1));
+        json["temp_max"] = serialized(String(a->t_max / 10.0, 1));
+        json["temp_mean"] = serialized(String(a->t_sum / 10.0 / a->count, 1));
+    }
+    if (a->h_count > 0) {
+        json["humi_min"] = a->h_min;
+        json["humi_max"] = a->h_max;
+        json["humi_mean"] = serialized(String((float)a->h_sum / a->h_count, 1));
+    }
+    json["count"] = a->count;
+    json["window"] = m * 60;
+    return true;
+}
+
+void agg_reset(int w, int ID)
+{
+    memset(&agg[w][ID], 0, sizeof(Aggregate));
+}
@@ -0,0 +1,33 @@
+#ifndef _AGGREGATE_H
+#define _AGGREGATE_H
+
+#include "Arduino.h"
+#include "globals.h"
+#include "decoder.h"
+#include <ArduinoJson.h>
+
+/*
+ * Per sensor min/max/mean over fixed time windows.
+ * Every frame updates a fixed size accumulator in O(1), no samples are stored.
+ * The window lengths are configured in config.agg_minutes[], 0 disables a window.
+ * Changing the length or disabling a window discards what it collected. Once
+ * the time is set via SNTP, the windows end on wall clock boundaries.
+ */
+struct Aggregate {
+    int32_t  t_sum;     /* temperature in 1/10 degrees */
+    uint32_t h_sum;     /* humidity in % */
+    int16_t  t_min;
+    int16_t  t_max;
+    uint16_t count;     /* number of frames with temperature */
+    uint16_t h_count;   /* number of frames with humidity */
+    uint8_t  h_min;
+    uint8_t  h_max;
+};
+
+/* temp_ok, humi_ok: the values passed the plausibility filter */
+void agg_update(SensorFrame *f, bool temp_ok, bool humi_ok);
+bool agg_window_due(int w);
+bool agg_render(int w, int ID, String &topic_suffix, JsonDocument &json);
+void agg_reset(int w, int ID);
+
+#endif
@@ -0,0 +1,40 @@
+#include "boot.h"
+
+struct BootPhase {
+    const char *name;   /* must be a string literal */
+    uint32_t us;        /* microseconds since power on / reset */
+};
+
+static BootPhase phases[BOOT_PHASES_MAX];
+static volatile int num_phases;
+static portMUX_TYPE boot_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/* set by the background init task, once filesystem and config are ready */
+volatile bool boot_done = false;
+
+/* can be called from setup() and the init task concurrently */
+void boot_mark(const char *phase)
+{
+    uint32_t now = (uint32_t)esp_timer_get_time();
+    portENTER_CRITICAL(&boot_mux);
+    int i = num_phases;
+    if (i < BOOT_PHASES_MAX) {
+        phases[i].name = phase;
+        phases[i].us = now;
+        num_phases = i + 1;
+    }
+    portEXIT_CRITICAL(&boot_mux);
+    if (i < BOOT_PHASES_MAX)
+        Serial.printf("boot: %-12s %7.1f ms\r\n", phase, now / 1000.0);
+}
+
+void boot_phases_json(JsonDocument &doc)
+{
+    int n = num_phases;
+    for (int i = 0; i < n; i++) {
+        JsonObject p = doc["phases"].add<JsonObject>();
+        p["name"] = phases[i].name;
+        p["ms"] = phases[i].us / 1000.0;
+    }
+    doc["done"] = (bool)boot_done;
+}
@@ -0,0 +1,15 @@
+#ifndef _BOOT_H
+#define _BOOT_H
+
+#include "Arduino.h"
+#include <ArduinoJson.h>
+
+/* timestamps of the startup phases, shown at /api/boot */
+#define BOOT_PHASES_MAX 16
+
+extern volatile bool boot_done;
+
+void boot_mark(const char *phase);
+void boot_phases_json(JsonDocument &doc);
+
+#endif
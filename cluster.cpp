@@ -0,0 +1,260 @@
+#include "cluster.h"
+#include "mempool.h"
+
+#define BIT_GET(a, n) ((a)[(n) >> 3] & (1 << ((n) & 7)))
+#define BIT_SET(a, n) ((a)[(n) >> 3] |= (1 << ((n) & 7)))
+#define BIT_CLR(a, n) ((a)[(n) >> 3] &= ~(1 << ((n) & 7)))
+
+struct Peer {
+    char id[32];                /* mqtt_id of the peer, empty == unused */
+    unsigned long seen;         /* millis() of the last summary */
+    int8_t rssi[SENSOR_NUM];    /* 0 == not heard */
+    uint8_t owns[SENSOR_NUM / 8];
+};
+
+static Peer peers[CLUSTER_PEERS];
+static int16_t local_rssi[SENSOR_NUM];      /* smoothed, 1/10 dBm */
+static unsigned long local_heard[SENSOR_NUM];
+static int8_t pub_rssi[SENSOR_NUM];         /* as sent in our last summary, 0 == not sent */
+static uint8_t owned[SENSOR_NUM / 8];
+static unsigned long last_summary;
+static bool dirty;
+static bool was_enabled;
+static bool settling = true;     /* also before the first connect */
+static unsigned long connected_at;
+static uint32_t takeovers, handovers;
+
+String cluster_topic()
+{
+    return String(CLUSTER_TOPIC) + mqtt_id;
+}
+
+static bool heard(uint8_t ID, unsigned long now)
+{
+    return local_heard[ID] != 0 && now - local_heard[ID] < CLUSTER_HEARD_MS;
+}
+
+static bool alive(const Peer *p, unsigned long now)
+{
+    return p->id[0] != 0 && now - p->seen < CLUSTER_PEER_TIMEOUT_MS;
+}
+
+/* just connected, the retained summaries of the peers may still be on the way */
+static bool settled(unsigned long now)
+{
+    if (settling && mqtt_ok && now - connected_at >= CLUSTER_SETTLE_MS)
+        settling = false;
+    return !settling;
+}
+
+void cluster_heard(uint8_t ID, int rssi)
+{
+    unsigned long now = millis();
+    if (!heard(ID, now))
+        local_rssi[ID] = rssi * 10;
+    else
+        local_rssi[ID] += (rssi * 10 - local_rssi[ID]) / 4;
+    local_heard[ID] = now;
+}
+
+static int8_t rssi_dbm(uint8_t ID)
+{
+    int r = (local_rssi[ID] - 5) / 10;  /* round, values are negative */
+    return constrain(r, -127, -1);
+}
+
+/* a is the better receiver than b; equal RSSI is decided by the lower mqtt_id */
+static bool better(int a_rssi, const char *a_id, int b_rssi, const char *b_id)
+{
+    if (a_rssi != b_rssi)
+        return a_rssi > b_rssi;
+    return strcmp(a_id, b_id) < 0;
+}
+
+/*
+ * All gateways compare the RSSI values from the summaries, so they come to
+ * the same result. Our own value is the one we published, the live value is
+ * only used until the sensor is part of a summary.
+ */
+static bool elect(uint8_t ID)
+{
+    unsigned long now = millis();
+    bool own = false;
+    if (!settled(now))
+        return BIT_GET(owned, ID);
+    if (heard(ID, now)) {
+        int mine = pub_rssi[ID] ? pub_rssi[ID] : rssi_dbm(ID);
+        const char *me = mqtt_id.c_str();
+        const Peer *best = NULL, *owner = NULL;
+        for (int i = 0; i < CLUSTER_PEERS; i++) {
+            const Peer *p = &peers[i];
+            if (!alive(p, now) || p->rssi[ID] == 0)
+                continue;
+            if (!best || better(p->rssi[ID], p->id, best->rssi[ID], best->id))
+                best = p;
+            if (BIT_GET(p->owns, ID) && (!owner || better(p->rssi[ID], p->id, owner->rssi[ID], owner->id)))
+                owner = p;
+        }
+        if (BIT_GET(owned, ID))
+            /* keep it until a better gateway has taken over, two owners for a short time are better than none */
+            own = !owner || better(mine, me, owner->rssi[ID], owner->id);
+        else if (owner)
+            own = mine > owner->rssi[ID] + CLUSTER_HYST_DB;
+        else
+            own = !best || better(mine, me, best->rssi[ID], best->id);
+    }
+    if (own != !!BIT_GET(owned, ID)) {
+        if (own) {
+            BIT_SET(owned, ID);
+            takeovers++;
+        } else {
+            BIT_CLR(owned, ID);
+            handovers++;
+        }
+        dirty = true;
+    }
+    return own;
+}
+
+bool cluster_owns(uint8_t ID)
+{
+    if (!config.cluster)
+        return true;
+    return elect(ID);
+}
+
+bool cluster_owned(uint8_t ID)
+{
+    return !config.cluster || BIT_GET(owned, ID);
+}
+
+/*
+ * After every (re)connect, the retained summaries of all peers are sent again.
+ * The peers are kept meanwhile, they time out as usual: forgetting them would
+ * make us take over all sensors until their summaries have arrived.
+ */
+void cluster_connected()
+{
+    if (config.cluster) {
+        was_enabled = true;
+        dirty = true;
+        settling = true;
+        connected_at = millis();
+        last_summary = connected_at - CLUSTER_SUMMARY_MS;
+    } else if (was_enabled) {
+        /* left the cluster, remove our summary */
+        was_enabled = false;
+        memset(peers, 0, sizeof(peers));
+        memset(owned, 0, sizeof(owned));
+        memset(pub_rssi, 0, sizeof(pub_rssi));
+        mqtt_publish(cluster_topic(), (const uint8_t *)"", 0, true);
+    }
+}
+
+void cluster_receive(char *topic, uint8_t *payload, unsigned int len)
+{
+    const size_t plen = strlen(CLUSTER_TOPIC);
+    if (strncmp(topic, CLUSTER_TOPIC, plen) != 0)
+        return;
+    const char *id = topic + plen;
+    if (mqtt_id == id || strlen(id) >= sizeof(peers[0].id))
+        return;
+    unsigned long now = millis();
+    Peer *p = NULL, *free_slot = NULL;
+    for (int i = 0; i < CLUSTER_PEERS; i++) {
+        if (strcmp(peers[i].id, id) == 0)
+            p = &peers[i];
+        else if (!free_slot && !alive(&peers[i], now))
+            free_slot = &peers[i];
+    }
+    if (len == 0) {
+        /* last will or peer left the cluster */
+        if (p) {
+            Serial.printf("cluster: peer %s left\n", id);
+            memset(p, 0, sizeof(Peer));
+        }
+        return;
+    }
+    if (payload[0] != CLUSTER_VERSION)
+        return;
+    if (!p) {
+        if (!free_slot) {
+            Serial.printf("cluster: no room for peer %s\n", id);
+            return;
+        }
+        p = free_slot;
+        Serial.printf("cluster: new peer %s\n", id);
+    }
+    memset(p, 0, sizeof(Peer));
+    strcpy(p->id, id);
+    for (unsigned int i = 1; i + 3 <= len; i += 3) {
+        uint8_t ID = payload[i];
+        p->rssi[ID] = (int8_t)payload[i + 1];
+        if (payload[i + 2] & CLUSTER_OWNER)
+            BIT_SET(p->owns, ID);
+    }
+    p->seen = now;
+}
+
+void cluster_job()
+{
+    if (!config.cluster || !mqtt_ok)
+        return;
+    unsigned long now = millis();
+    /* while settling, elect() keeps what we own, which is what the peers need to know */
+    if (now - last_summary < (dirty ? CLUSTER_MIN_GAP_MS : CLUSTER_SUMMARY_MS))
+        return;
+    char *buf = pool_get(MEM_MQTT, 1 + 3 * SENSOR_NUM);
+    if (!buf)
+        return;
+    unsigned int len = 0;
+    buf[len++] = CLUSTER_VERSION;
+    for (int ID = 0; ID < SENSOR_NUM; ID++) {
+        pub_rssi[ID] = heard(ID, now) ? rssi_dbm(ID) : 0;
+        bool own = elect(ID);
+        if (pub_rssi[ID] == 0)
+            continue;
+        buf[len++] = ID;
+        buf[len++] = (uint8_t)pub_rssi[ID];
+        buf[len++] = own ? CLUSTER_OWNER : 0;
+    }
+    mqtt_publish(cluster_topic(), (const uint8_t *)buf, len, true);
+    pool_put(MEM_MQTT, buf);
+    last_summary = now;
+    dirty = false;
+}
+
+void cluster_json(JsonObject obj)
+{
+    unsigned long now = millis();
+    int n_owned = 0, n_heard = 0;
+    for (int ID = 0; ID < SENSOR_NUM; ID++) {
+        if (!heard(ID, now))
+            continue;
+        n_heard++;
+        if (BIT_GET(owned, ID))
+            n_owned++;
+    }
+    obj["heard"] = n_heard;
+    obj["owned"] = n_owned;
+    obj["takeovers"] = takeovers;
+    obj["handovers"] = handovers;
+    JsonArray arr = obj["peers"].to<JsonArray>();
+    for (int i = 0; i < CLUSTER_PEERS; i++) {
+        const Peer *p = &peers[i];
+        if (!alive(p, now))
+            continue;
+        int n = 0, o = 0;
+        for (int ID = 0; ID < SENSOR_NUM; ID++) {
+            if (p->rssi[ID] != 0)
+                n++;
+            if (BIT_GET(p->owns, ID))
+                o++;
+        }
+        JsonObject peer = arr.add<JsonObject>();
+        peer["id"] = p->id;
+        peer["age_s"] = (now - p->seen) / 1000;
+        peer["heard"] = n;
+        peer["owned"] = o;
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef _CLUSTER_H
+#define _CLUSTER_H
+
+#include "Arduino.h"
+#include "globals.h"
+#include <ArduinoJson.h>
+
+/*
+ * Cooperation of several gateways receiving the same sensors (config.cluster).
+ * Every gateway publishes a retained summary of the sensors it hears to
+ * CLUSTER_TOPIC<mqtt_id>: one version byte, then 3 bytes per sensor
+ * (ID, smoothed RSSI in dBm as int8, flags). Each sensor is published only by
+ * its owner, the gateway with the best RSSI. A challenger needs to be better
+ * by CLUSTER_HYST_DB to take over, so ownership does not flap.
+ * Peers whose summary is older than CLUSTER_PEER_TIMEOUT_MS, or was cleared
+ * by their last will, are ignored and their sensors are taken over.
+ * After a (re)connect, ownership is frozen for CLUSTER_SETTLE_MS until the
+ * retained summaries of the peers have arrived. Our own summary is sent
+ * right away, so the peers do not time us out meanwhile.
+ */
+#define CLUSTER_TOPIC "lacrosse/cluster/"
+#define CLUSTER_VERSION 1
+#define CLUSTER_OWNER 0x01          /* flags: this gateway publishes the sensor */
+#define CLUSTER_PEERS 8
+#define CLUSTER_HYST_DB 6
+#define CLUSTER_FRAME_MS (4 * 1000UL)    /* the sensors send about this often */
+/* a summary per frame, so a vanished peer is noticed after a few frames */
+#define CLUSTER_SUMMARY_MS CLUSTER_FRAME_MS
+#define CLUSTER_MIN_GAP_MS (2 * 1000UL)  /* rate limit for summaries after ownership changes */
+#define CLUSTER_HEARD_MS (90 * 1000UL)   /* sensors not heard for longer are dropped */
+#define CLUSTER_PEER_TIMEOUT_MS (4 * CLUSTER_SUMMARY_MS + 2 * 1000UL) /* + delivery */
+#define CLUSTER_SETTLE_MS (5 * 1000UL)
+#define CLUSTER_BUF_SIZE (64 + 1 + 3 * SENSOR_NUM) /* PubSubClient buffer for receiving summaries */
+
+String cluster_topic();
+void cluster_heard(uint8_t ID, int rssi);
+bool cluster_owns(uint8_t ID);
+/* the result of the last cluster_owns(), for display */
+bool cluster_owned(uint8_t ID);
+void cluster_connected();
+void cluster_receive(char *topic, uint8_t *payload, unsigned int len);
+void cluster_job();
+void cluster_json(JsonObject obj);
+
+#endif
@@ -22,6 +22,7 @@ esac
 
 
 MYVERSION=$(git describe --always --dirty)
+BIN=build/esp32.esp32.$BOARD_NAME/lacrosse2mqtt.ino.bin
 PARAM=()
 if [ "$IAM" = upload ]; then
 	if [ -z "$1" ]; then
@@ -29,9 +30,21 @@ if [ "$IAM" = upload ]; then
 		exit 1
 	fi
 	if ! [[ "$1" =~ "/dev/"* ]]; then
-		curl -v -F "image=@build/esp32.esp32.$BOARD_NAME/lacrosse2mqtt.ino.bin" \
+		if ! [ -e "$BIN" ]; then
+			echo "$BIN not found, compile first"
+			exit 1
+		fi
+		# prefer the compressed image, the device checks the md5 of the
+		# uncompressed image before switching to it.
+		# gzip -k keeps the mtime, so only a .gz older than the image is stale
+		IMG=$BIN
+		[ -e "$BIN.gz" ] && ! [ "$BIN" -nt "$BIN.gz" ] && IMG=$BIN.gz
+		MD5=$(md5sum < "$BIN" | cut -d ' ' -f 1)
+		echo "uploading $IMG ($(stat -c %s "$IMG") bytes), md5 $MD5"
+		curl -v -F "image=@$IMG" \
 			-H "Origin: http://$1" \
-			"$1"/update
+			-w "sent %{size_upload} bytes in %{time_total} s (%{speed_upload} bytes/s)\n" \
+			"$1/update?md5=$MD5"
 		echo
 		exit
 	fi
@@ -48,4 +61,9 @@ else
 	PARAM+=(--warnings all)
 fi
 
-arduino-cli "$IAM" -b esp32:esp32:${BOARD_NAME}${BOARD_REV} "${PARAM[@]}" "$@"
+arduino-cli "$IAM" -b esp32:esp32:${BOARD_NAME}${BOARD_REV} "${PARAM[@]}" "$@" || exit
+if [ "$IAM" = compile ] && [ -e "$BIN" ]; then
+	# compressed image for OTA upload
+	gzip -9 -n -k -f "$BIN"
+	echo "$BIN: $(stat -c %s "$BIN") bytes, $BIN.gz: $(stat -c %s "$BIN.gz") bytes"
+fi
@@ -0,0 +1,68 @@
+#include "decoder.h"
+#include "lacrosse.h"
+
+/*
+ * All known protocols. To add a new one, implement TryHandleData() and
+ * DisplayFrame() and add an entry here. Decoders may share data rate and
+ * start nibble if their frame lengths differ, the build fails if they do not
+ * or if more than DISPATCH_MAX of them share a data rate and start nibble.
+ */
+static constexpr Decoder decoders[] = {
+    { "LaCrosse", FRAME_LENGTH, NIBBLE(0x9), RATE_ALL, LaCrosse::TryHandleData, LaCrosse::DisplayFrame },
+#ifdef DECODERS_EXTRA
+    DECODERS_EXTRA  /* host test */
+#endif
+};
+#define NUM_DECODERS (int)(sizeof(decoders) / sizeof(decoders[0]))
+
+/* decoders per data rate and start nibble, told apart by the frame length */
+#define DISPATCH_MAX 2
+
+static constexpr bool claims(int d, int r, int n)
+{
+    return (decoders[d].rates & (1 << r)) && (decoders[d].nibbles & NIBBLE(n));
+}
+
+/* index + 1 of the k-th decoder for data rate r and start nibble n, starting at decoder d, 0 == none */
+static constexpr uint8_t nth(int r, int n, int k, int d = 0)
+{
+    return d >= NUM_DECODERS ? 0 :
+           !claims(d, r, n) ? nth(r, n, k, d + 1) :
+           k == 0 ? d + 1 : nth(r, n, k - 1, d + 1);
+}
+
+/* too many decoders for data rate r and start nibble n, or two with the same frame length */
+static constexpr bool bad_slot(int r, int n)
+{
+    return nth(r, n, DISPATCH_MAX) != 0 ||
+           (nth(r, n, 1) != 0 && decoders[nth(r, n, 0) - 1].frame_len == decoders[nth(r, n, 1) - 1].frame_len);
+}
+
+static constexpr bool bad_table(int i = 0)
+{
+    return i >= NUM_DATARATES * 16 ? false : bad_slot(i / 16, i % 16) || bad_table(i + 1);
+}
+
+static_assert(!bad_table(), "decoders[]: too many decoders or two with the same frame length for a data rate and start nibble");
+static_assert(NUM_DATARATES == 2 && DISPATCH_MAX == 2, "adjust DISPATCH_ROW() and DISPATCH_SLOT()");
+
+/* index + 1 into decoders[] by data rate and start nibble, built by the compiler */
+#define DISPATCH_SLOT(r, n) { nth(r, n, 0), nth(r, n, 1) }
+#define DISPATCH_ROW(r) { \
+    DISPATCH_SLOT(r, 0x0), DISPATCH_SLOT(r, 0x1), DISPATCH_SLOT(r, 0x2), DISPATCH_SLOT(r, 0x3), \
+    DISPATCH_SLOT(r, 0x4), DISPATCH_SLOT(r, 0x5), DISPATCH_SLOT(r, 0x6), DISPATCH_SLOT(r, 0x7), \
+    DISPATCH_SLOT(r, 0x8), DISPATCH_SLOT(r, 0x9), DISPATCH_SLOT(r, 0xA), DISPATCH_SLOT(r, 0xB), \
+    DISPATCH_SLOT(r, 0xC), DISPATCH_SLOT(r, 0xD), DISPATCH_SLOT(r, 0xE), DISPATCH_SLOT(r, 0xF) }
+static constexpr uint8_t dispatch[NUM_DATARATES][16][DISPATCH_MAX] = { DISPATCH_ROW(0), DISPATCH_ROW(1) };
+
+const Decoder *decoder_find(const byte *data, uint8_t len, int rate_idx)
+{
+    if (len == 0 || rate_idx < 0 || rate_idx >= NUM_DATARATES)
+        return NULL;
+    const uint8_t *d = dispatch[rate_idx][data[0] >> 4];
+    for (int k = 0; k < DISPATCH_MAX && d[k]; k++) {
+        if (decoders[d[k] - 1].frame_len == len)
+            return &decoders[d[k] - 1];
+    }
+    return NULL;
+}
@@ -0,0 +1,47 @@
+#ifndef _DECODER_H
+#define _DECODER_H
+
+#include "Arduino.h"
+#include "globals.h"
+
+/* number of data rates the receiver cycles through, see datarates_bps[] */
+#define NUM_DATARATES 2
+/* bitmasks for Decoder::rates, index into datarates_bps[] */
+#define RATE_9579   (1 << 0)
+#define RATE_17241  (1 << 1)
+#define RATE_ALL    (RATE_9579 | RATE_17241)
+/* bitmask for Decoder::nibbles, n is the upper nibble of the first byte */
+#define NIBBLE(n)   (1 << (n))
+
+/* decoded values of one sensor frame, filled in by Decoder::TryHandleData() */
+struct SensorFrame {
+    uint8_t ID;         /* byte 1 */
+    int8_t  humi;       /* byte 2 */
+    int8_t  rssi;       /* byte 3 */
+    uint8_t init:1;     /* byte 4 */
+    uint8_t batlo:1;    /* ordering... */
+    uint8_t valid:1;    /* ..is important.. */
+    uint8_t pad:5;      /* ...for alignment */
+    float   temp;       /* byte 5-8 */
+    int     rate;       /* byte 9-12 */
+    uint32_t rx_us;     /* byte 13-16, esp_timer time of the radio interrupt */
+};
+
+/*
+ * A protocol decoder. All decoders are listed in decoders[] in decoder.cpp,
+ * the compiler builds a dispatch table indexed by data rate and start nibble
+ * from this list, so finding the decoder for a frame is a table lookup and a
+ * length compare instead of trying every decoder in turn.
+ */
+struct Decoder {
+    const char *name;
+    uint8_t frame_len;  /* frame length in bytes */
+    uint16_t nibbles;   /* accepted start nibbles, NIBBLE(x) | ... */
+    uint8_t rates;      /* accepted data rates, RATE_xxx | ... */
+    bool (*TryHandleData)(byte *data, struct SensorFrame *frame);
+    bool (*DisplayFrame)(byte *data, struct SensorFrame *frame);
+};
+
+const Decoder *decoder_find(const byte *data, uint8_t len, int rate_idx);
+
+#endif
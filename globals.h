@@ -1,6 +1,8 @@
 #ifndef _GLOBALS_H
 #define _GLOBALS_H
 
+#include <ArduinoJson.h>
+
 #if defined(WIFI_LoRa_32_V3)
 /* Heltec WiFi LoRa 32 V3 (SX1262) */
 #define OLED_SDA  SDA_OLED
@@ -50,6 +52,8 @@ static const uint8_t LED_BUILTIN = 2;
 #define FRAME_LENGTH 5
 /* maximum number of sensors: 64 x 2 channels x 2 datarates */
 #define SENSOR_NUM 256
+/* number of configurable aggregation windows, see aggregate.h */
+#define AGG_WINDOWS 2
 
 struct Cache {
     unsigned long timestamp;
@@ -57,6 +61,20 @@ struct Cache {
     int8_t rssi;
 };
 
+/* MQTT payload layout, Config::payload_mode */
+enum {
+    PAYLOAD_TOPICS = 0, /* one topic per value: temp, humi, state */
+    PAYLOAD_JSON,       /* one JSON object per frame */
+    PAYLOAD_MSGPACK     /* one MessagePack record per frame */
+};
+
+struct MqttStats {
+    uint32_t publishes;     /* number of PUBLISH packets sent */
+    uint32_t bytes;         /* MQTT bytes on the wire, without TCP/IP overhead */
+    float pub_per_s;        /* averaged over the last minute */
+    float bytes_per_s;
+};
+
 struct Config {
     String mqtt_server;
     String mqtt_user;
@@ -65,13 +83,39 @@ struct Config {
     bool display_on;
     bool changed;
     bool ha_discovery;
+    uint16_t agg_minutes[AGG_WINDOWS]; /* aggregation window length, 0 == off */
+    uint8_t payload_mode;   /* PAYLOAD_xxx */
+    uint16_t batch_ms;      /* collect frames for this long into one message, 0 == off */
+    String ntp_server;      /* empty == no time sync */
+    bool auto_tune;         /* adjust center frequency and bandwidth, see tuning.h */
+    bool cluster;           /* cooperate with other gateways, see cluster.h */
+    bool qos1;              /* publish sensor data with QoS 1, see qos.h */
+    uint8_t qos_window;     /* QoS 1 messages in flight */
 };
 
 extern Config config;
 extern Cache fcache[];
-extern String id2name[SENSOR_NUM];
 extern bool littlefs_ok;
 extern bool mqtt_ok;
+extern bool radio_ok;
+extern MqttStats mqtt_stats;
+extern uint32_t rxq_dropped;
+extern uint32_t rxq_merged;
+extern String mqtt_id;
+extern const String pretty_base;
+extern const String pub_base;
+
+/*
+ * fcache, labels, config and the MQTT state are shared between loop() and the
+ * web server task. Recursive, so loop() can nest it.
+ */
+bool lock_state(uint32_t ticks = portMAX_DELAY);
+void unlock_state();
+
+void mqtt_count(unsigned int topic_len, unsigned int len);
+bool mqtt_publish(const String &topic, const uint8_t *payload, unsigned int len, bool retained = false);
+bool mqtt_publish(const String &topic, const String &payload, bool retained = false);
+bool mqtt_publish(const String &topic, JsonDocument &json, bool msgpack = false);
 
 /* ugly... */
 static inline uint32_t uptime_sec() { return (esp_timer_get_time()/(int64_t)1000000); }
@@ -0,0 +1,209 @@
+#include "hass.h"
+#include <ArduinoJson.h>
+#include "mempool.h"
+#include "labels.h"
+
+/* publish at most one discovery message every HASS_PACE_MS milliseconds */
+#define HASS_PACE_MS 50
+
+struct HassEntry {
+    char *buf;      /* "topic\0payload\0" for every kind in 'kinds', ascending */
+    uint8_t kinds;  /* rendered kinds */
+    uint8_t want;   /* hass_want[] at the time of rendering */
+    uint16_t len;   /* size of buf */
+};
+
+uint8_t hass_cfg[SENSOR_NUM];
+static uint8_t hass_want[SENSOR_NUM];   /* kinds seen for this sensor */
+static bool hass_dirty[SENSOR_NUM];     /* label changed, cache entry is outdated */
+static HassEntry hass_cache[SENSOR_NUM];
+
+static const String hass_base = "homeassistant/sensor/";
+
+/* uses the abbreviated keys documented by Home Assistant to keep the cache small */
+static bool render_config(int what, byte ID, String &topic, String &msg)
+{
+#define is_battery (what == HASS_BATT)
+    static const char* const name[3] = { "Luftfeuchtigkeit", "Temperatur", "Batterie_schwach" };
+    static const char* const value[3] = { "humi", "temp", "batt_low" };
+    static const char* const dclass[3] = { "humidity", "temperature", "battery" };
+    static const char* const unit[2] = { "%", "°C" };
+    static const char* const mdi[2] = { "mdi:water-percent", "mdi:thermometer" };
+    const char *where = labels.get(ID);
+    const char *where_lower = labels.lower(ID);
+
+    /* the battery state is only available as plain JSON */
+    if (is_battery && (config.payload_mode == PAYLOAD_MSGPACK ||
+                       (config.payload_mode == PAYLOAD_JSON && config.batch_ms > 0)))
+        return false;
+
+    JsonDocument cfg(&json_pool);
+
+    /*
+     * mosquitto_pub -h server -t 'homeassistant/sensor/lacrosse2mqtt_aussen_temp/config' -m \
+     * '{
+          "stat_cla": "measurement",
+          "dev_cla": "temperature",
+          "stat_t":"climate/Aussen/temp",
+          "uniq_id":"lacrosse2mqtt_123456_aussen_temp",
+          "unit_of_meas":"°C",
+          "name":"Temperatur",
+          ...
+      }'
+     */
+    /* in cluster mode, any gateway may publish the config, so the IDs must not depend on it */
+    String gw = config.cluster ? String("lacrosse2mqtt_cluster") : mqtt_id;
+    String uid = gw + "_" + where_lower + "_" + value[what];
+    if (is_battery)
+        topic = String("homeassistant/binary_sensor/");
+    else
+        topic = hass_base;
+    topic += uid +  "/config";
+    cfg["dev"]["ids"][0] = gw + "_" +where_lower;
+    cfg["dev"]["name"] = where;
+    cfg["dev"]["mf"] = "Lacrosse2MQTT";
+    cfg["dev"]["mdl"] = "esp32";
+    cfg["o"]["name"] = "lacrosse2mqtt";
+    cfg["o"]["url"] = "https://github.com/seife/lacrosse2mqtt";
+    if (! is_battery) {
+        cfg["stat_cla"] = "measurement";
+        cfg["unit_of_meas"] = unit[what];
+        cfg["stat_t"] = pretty_base + where + "/" + value[what];
+        cfg["ic"] = mdi[what];
+    } else {
+        if (config.payload_mode == PAYLOAD_JSON)
+            cfg["stat_t"] = pub_base + String(ID, DEC) + "/data";
+        else
+            cfg["stat_t"] = pub_base + String(ID, DEC) + "/state";
+        cfg["val_tpl"] = "{{ value_json.low_batt }}";
+        cfg["pl_on"] = "true";   /* boolean does not seem to work, so we send a string */
+        cfg["pl_off"] = "false";
+    }
+    cfg["dev_cla"] = dclass[what];
+    cfg["uniq_id"] = uid;
+    cfg["name"] = name[what];
+    msg = String();
+    serializeJson(cfg, msg);
+    return true;
+#undef is_battery
+}
+
+static void render_entry(int ID)
+{
+    hass_dirty[ID] = false;
+    free(hass_cache[ID].buf);
+    mem_account_heap(MEM_HASS, -(int32_t)hass_cache[ID].len);
+    hass_cache[ID].buf = NULL;
+    hass_cache[ID].len = 0;
+    hass_cache[ID].kinds = 0;
+    hass_cache[ID].want = hass_want[ID];
+    if (!labels.has(ID))
+        return;
+
+    String topic[HASS_KINDS], msg[HASS_KINDS];
+    size_t len = 0;
+    uint8_t kinds = 0;
+    for (int what = 0; what < HASS_KINDS; what++) {
+        if (!(hass_want[ID] & (1 << what)))
+            continue;
+        if (!render_config(what, ID, topic[what], msg[what]))
+            continue;
+        len += topic[what].length() + 1 + msg[what].length() + 1;
+        kinds |= (1 << what);
+    }
+    if (kinds == 0)
+        return;
+    char *buf = (char *)malloc(len);
+    if (!buf) {
+        Serial.printf("HA discovery: out of memory for ID %d\r\n", ID);
+        return;
+    }
+    char *p = buf;
+    for (int what = 0; what < HASS_KINDS; what++) {
+        if (!(kinds & (1 << what)))
+            continue;
+        memcpy(p, topic[what].c_str(), topic[what].length() + 1);
+        p += topic[what].length() + 1;
+        memcpy(p, msg[what].c_str(), msg[what].length() + 1);
+        p += msg[what].length() + 1;
+    }
+    mem_account_heap(MEM_HASS, len);
+    hass_cache[ID].buf = buf;
+    hass_cache[ID].kinds = kinds;
+    hass_cache[ID].len = len;
+}
+
+static bool publish_entry(int ID, int what)
+{
+    const char *p = hass_cache[ID].buf;
+    for (int i = 0; i < what; i++) {
+        if (!(hass_cache[ID].kinds & (1 << i)))
+            continue;
+        p += strlen(p) + 1; /* topic */
+        p += strlen(p) + 1; /* payload */
+    }
+    const char *msg = p + strlen(p) + 1;
+    Serial.printf("HA discovery: %s\r\n", p);
+    return mqtt_publish(String(p), (const uint8_t *)msg, strlen(msg), true);
+}
+
+/* called from the receive path, must stay cheap */
+void hass_request(uint8_t ID, uint8_t kinds)
+{
+    hass_want[ID] |= kinds;
+}
+
+void hass_label_changed(int ID)
+{
+    hass_dirty[ID] = true;
+    hass_cfg[ID] = 0;
+}
+
+void hass_labels_changed()
+{
+    for (int i = 0; i < SENSOR_NUM; i++)
+        hass_label_changed(i);
+}
+
+/* after MQTT (re)connect, everything needs to be sent again */
+void hass_reset()
+{
+    for (int i = 0; i < SENSOR_NUM; i++)
+        hass_cfg[i] = 0;
+}
+
+void hass_job()
+{
+    static unsigned long last = 0;
+    static int cursor = 0;
+    if (!config.ha_discovery)
+        return;
+
+    /* render at most one entry per call */
+    for (int i = 0; i < SENSOR_NUM; i++) {
+        if (hass_dirty[i] || hass_want[i] != hass_cache[i].want) {
+            render_entry(i);
+            break;
+        }
+    }
+
+    unsigned long now = millis();
+    if (!mqtt_ok || now - last < HASS_PACE_MS)
+        return;
+    for (int n = 0; n < SENSOR_NUM; n++) {
+        int ID = (cursor + n) % SENSOR_NUM;
+        if (hass_dirty[ID])
+            continue;
+        uint8_t todo = hass_want[ID] & hass_cache[ID].kinds & ~hass_cfg[ID];
+        if (!todo)
+            continue;
+        int what = 0;
+        while (!(todo & (1 << what)))
+            what++;
+        if (publish_entry(ID, what))
+            hass_cfg[ID] |= (1 << what);
+        cursor = ID;
+        last = now;
+        return;
+    }
+}
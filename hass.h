@@ -0,0 +1,31 @@
+#ifndef _HASS_H
+#define _HASS_H
+
+#include "Arduino.h"
+#include "globals.h"
+
+/*
+ * Home Assistant discovery.
+ * The config messages are rendered in the background whenever a label changes
+ * and kept in a cache, hass_job() publishes them paced from loop() after
+ * (re)connect. The receive path only sets bits via hass_request().
+ */
+
+/* kinds of discovery messages, bit numbers for hass_request() */
+enum {
+    HASS_HUMI = 0,
+    HASS_TEMP,
+    HASS_BATT,
+    HASS_KINDS
+};
+
+/* already published kinds per sensor ID */
+extern uint8_t hass_cfg[SENSOR_NUM];
+
+void hass_request(uint8_t ID, uint8_t kinds);
+void hass_label_changed(int ID);
+void hass_labels_changed();
+void hass_reset();
+void hass_job();
+
+#endif
@@ -0,0 +1,72 @@
+#include "labels.h"
+
+/* grow the arena in steps, to avoid a realloc for every label */
+#define LABEL_ARENA_STEP 128
+
+LabelTable labels;
+
+/* drop a label and move the following ones down, so that the arena has no holes */
+void LabelTable::remove(uint8_t ID)
+{
+    if (!has(ID))
+        return;
+    uint16_t off = _idx[ID].off;
+    uint16_t n = 2 * (_idx[ID].len + 1);
+    memmove(_arena + off, _arena + off + n, _used - off - n);
+    _used -= n;
+    for (int i = 0; i < SENSOR_NUM; i++)
+        if (has(i) && _idx[i].off > off)
+            _idx[i].off -= n;
+    _idx[ID].off = 0;
+    _idx[ID].len = 0;
+}
+
+bool LabelTable::set(uint8_t ID, const char *name, size_t len)
+{
+    if (len > LABEL_MAX_LEN)
+        len = LABEL_MAX_LEN;
+    if (len == length(ID) && strncmp(get(ID), name, len) == 0)
+        return true; /* unchanged */
+    remove(ID);
+    if (len == 0)
+        return true;
+    size_t need = _used + 2 * (len + 1);
+    if (need > _size) {
+        size_t size = (need + LABEL_ARENA_STEP - 1) / LABEL_ARENA_STEP * LABEL_ARENA_STEP;
+        char *tmp = (char *)realloc(_arena, size);
+        if (!tmp) {
+            Serial.println("labels: out of memory");
+            return false;
+        }
+        _arena = tmp;
+        _size = size;
+    }
+    char *p = _arena + _used;
+    memcpy(p, name, len);
+    p[len] = 0;
+    for (size_t i = 0; i < len; i++)
+        p[len + 1 + i] = tolower((unsigned char)name[i]);
+    p[2 * len + 1] = 0;
+    _idx[ID].off = _used;
+    _idx[ID].len = len;
+    _used = need;
+    return true;
+}
+
+void LabelTable::clear()
+{
+    free(_arena);
+    _arena = NULL;
+    _used = 0;
+    _size = 0;
+    memset(_idx, 0, sizeof(_idx));
+}
+
+int LabelTable::count() const
+{
+    int n = 0;
+    for (int i = 0; i < SENSOR_NUM; i++)
+        if (has(i))
+            n++;
+    return n;
+}
@@ -0,0 +1,44 @@
+#ifndef _LABELS_H
+#define _LABELS_H
+
+#include "Arduino.h"
+#include "globals.h"
+
+/*
+ * Sensor labels (ID -> name), replacing an array of SENSOR_NUM String objects.
+ * All labels live in one heap block, each stored as the name followed by its
+ * lowercase variant, both NUL terminated: "Aussen\0aussen\0".
+ * The index holds offset and length per ID. The returned pointers point into
+ * the arena, they are only valid until the next set() or clear().
+ */
+#define LABEL_MAX_LEN 64
+
+struct LabelIndex {
+    uint16_t off;
+    uint8_t len;    /* 0 == no label */
+};
+
+class LabelTable {
+public:
+    LabelTable() : _arena(NULL), _used(0), _size(0) {}
+    bool has(uint8_t ID) const { return _idx[ID].len > 0; }
+    uint8_t length(uint8_t ID) const { return _idx[ID].len; }
+    const char *get(uint8_t ID) const { return has(ID) ? _arena + _idx[ID].off : ""; }
+    const char *lower(uint8_t ID) const { return has(ID) ? _arena + _idx[ID].off + _idx[ID].len + 1 : ""; }
+    bool set(uint8_t ID, const char *name, size_t len);
+    bool set(uint8_t ID, const String &name) { return set(ID, name.c_str(), name.length()); }
+    void clear();
+    int count() const;
+    size_t used() const { return _used; }       /* bytes of the arena in use */
+    size_t heap_size() const { return _size; }  /* bytes allocated for the arena */
+private:
+    void remove(uint8_t ID);
+    LabelIndex _idx[SENSOR_NUM];
+    char *_arena;
+    uint16_t _used;
+    uint16_t _size;
+};
+
+extern LabelTable labels;
+
+#endif
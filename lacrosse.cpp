@@ -17,7 +17,7 @@
 * more details:
 * https://github.com/merbanan/rtl_433/blob/master/src/devices/lacrosse_tx35.c
 */
-void LaCrosse::DecodeFrame(byte *bytes, struct Frame *f)
+void LaCrosse::DecodeFrame(byte *bytes, Frame *f)
 {
     f->valid = true;
 
@@ -46,7 +46,7 @@ void LaCrosse::DecodeFrame(byte *bytes, struct Frame *f)
         f->ID |= 0x80;
 }
 
-bool LaCrosse::DisplayFrame(byte *data, struct Frame *f)
+bool LaCrosse::DisplayFrame(byte *data, Frame *f)
 {
     static unsigned long last[SENSOR_NUM]; /* one for each sensor ID */
 
@@ -64,12 +64,9 @@ bool LaCrosse::DisplayFrame(byte *data, struct Frame *f)
     return true;
 }
 
-bool LaCrosse::TryHandleData(byte *data, struct Frame *f)
+/* the start nibble has already been checked by decoder_find() */
+bool LaCrosse::TryHandleData(byte *data, Frame *f)
 {
-#if 0
-    if ((data[0] & 0xF0) != 0x90)
-        return false;
-#endif
     DecodeFrame(data, f);
     return f->valid;
 }
@@ -26,7 +26,19 @@
 #include "webfrontend.h"
 #include "globals.h"
 
+#include "decoder.h"
 #include "lacrosse.h"
+#include "aggregate.h"
+#include "hass.h"
+#include "mempool.h"
+#include "boot.h"
+#include "latency.h"
+#include "tuning.h"
+#include "cluster.h"
+#include "labels.h"
+#include "snapshot.h"
+#include "qos.h"
+#include "payload.h"
 
 //#define DEBUG_DAVFS
 
@@ -54,13 +66,23 @@ unsigned long last_switch = 0;
 // unsigned long last_display = 0;
 bool littlefs_ok;
 bool mqtt_ok;
+bool radio_ok;
 bool display_on = true;
 uint32_t auto_display_on = 0;
 
 Config config;
 Cache fcache[SENSOR_NUM]; /* 128 IDs x 2 datarates */
-String id2name[SENSOR_NUM];
-uint8_t hass_cfg[SENSOR_NUM];
+static SemaphoreHandle_t state_mutex;
+
+bool lock_state(uint32_t ticks)
+{
+    return xSemaphoreTakeRecursive(state_mutex, ticks) == pdTRUE;
+}
+
+void unlock_state()
+{
+    xSemaphoreGiveRecursive(state_mutex);
+}
 
 /* TTGO board OLED pins to ESP32 GPIOs */
 /*
@@ -83,20 +105,32 @@ SSD1306Wire display(0x3c, OLED_SDA, OLED_SCL);
   #define DI0 26 // interrupt mode did not work well
   ==> already defined in board header, also MOSI, MISO,...!
  */
-#if defined(WIFI_LoRa_32_V3)
+#if defined(SIMULATE_RADIO)
+#include "radio_sim.h"
+SimRadio radio;
+#define RADIO_NAME "[SIM]"
+#define RADIO_HAS_FEI
+#elif defined(WIFI_LoRa_32_V3)
 SX1262 radio = new Module(LORA_CS, LORA_IRQ, LORA_RST, LORA_BUSY);
 #define RADIO_NAME "[SX1262]"
 #else
 SX1276 radio = new Module(LORA_CS, LORA_IRQ, LORA_RST, RADIOLIB_NC);
 #define RADIO_NAME "[SX1276]"
+/* frequency error of the last packet, needs AFC enabled */
+#define RADIO_HAS_FEI
 #endif
+/* current receiver center frequency, relative to freq, and bandwidth (auto tuning) */
+int32_t rx_offset_hz = 0;
+float rx_bandwidth = 125.0;
 
 // flag set by the radio ISR when a full packet has been received
 volatile bool receivedFlag = false;
+volatile uint32_t receivedTime; /* esp_timer_get_time() of the interrupt */
 #if defined(ESP8266) || defined(ESP32)
   IRAM_ATTR
 #endif
 void onPacketReceived(void) {
+    receivedTime = (uint32_t)esp_timer_get_time();
     receivedFlag = true;
 }
 
@@ -106,6 +140,8 @@ static const int   datarates_bps[]  = { 9579,   17241   };
 static int currentRate = 0;
 
 void switchDataRate(int idx = -1) {
+    if (!radio_ok)
+        return;
     if (idx >= 0)
         currentRate = idx % 2;
     else
@@ -115,148 +151,238 @@ void switchDataRate(int idx = -1) {
     radio.startReceive();
 }
 
+void tuneRadio(int32_t offset_hz, float bandwidth)
+{
+    rx_offset_hz = offset_hz;
+    rx_bandwidth = bandwidth;
+    if (!radio_ok)
+        return;
+    radio.standby();
+    radio.setFrequency((freq * 1000.0 + offset_hz) / 1000000.0);
+    radio.setRxBandwidth(bandwidth);
+    radio.startReceive();
+}
+
 #define ESP_MANUFACTURER  "ESPRESSIF"
 #define ESP_MODEL_NUMBER  "ESP32"
 #define ESP_MODEL_NAME    "ESPRESSIF IOT"
 #define ESP_DEVICE_NAME   "ESP STATION"
 
-WiFiClient client;
-PubSubClient mqtt_client(client);
+PubSubClient mqtt_client(mqtt_link); /* mqtt_link wraps the WiFiClient for QoS 1 */
 String mqtt_id;
 const String pretty_base = "climate/";
 const String pub_base = "lacrosse/id_";
-const String hass_base = "homeassistant/sensor/";
 bool mqtt_server_set = false;
+MqttStats mqtt_stats;
+
+/*
+ * Connecting (DNS, TCP, CONNACK) can take seconds, so it runs in its own
+ * task and loop() keeps reading the radio meanwhile. While mqtt_connecting
+ * is set, only that task uses mqtt_client.
+ */
+struct MqttConnect {
+    String user, pass, will;
+    bool cluster;
+};
+static volatile bool mqtt_connecting;
+static volatile bool mqtt_connect_ok;   /* result, valid once mqtt_connecting is cleared */
+
+static void mqtt_connect_task(void *arg)
+{
+    MqttConnect *c = (MqttConnect *)arg;
+    const char *user = NULL;
+    const char *pass = NULL;
+    if (c->user.length()) {
+        user = c->user.c_str();
+        pass = c->pass.c_str();
+    }
+    if (c->cluster)
+        /* the broker clears our summary if we vanish, so others take over quickly */
+        mqtt_connect_ok = mqtt_client.connect(mqtt_id.c_str(), user, pass, c->will.c_str(), 0, true, "");
+    else
+        mqtt_connect_ok = mqtt_client.connect(mqtt_id.c_str(), user, pass);
+    delete c;
+    mqtt_connecting = false;
+    vTaskDelete(NULL);
+}
+
+/* account for a PUBLISH packet: fixed header, remaining length, topic length, topic, payload */
+void mqtt_count(unsigned int topic_len, unsigned int len)
+{
+    unsigned int rem = 2 + topic_len + len;
+    mqtt_stats.publishes++;
+    mqtt_stats.bytes += 1 + (rem < 128 ? 1 : (rem < 16384 ? 2 : 3)) + rem;
+}
+
+/* streams the payload, so it is not limited by the PubSubClient buffer size */
+bool mqtt_publish(const String &topic, const uint8_t *payload, unsigned int len, bool retained)
+{
+    if (mqtt_connecting)
+        return false;
+    if (qos_publish(topic, payload, len, retained))
+        return true;
+    if (!mqtt_client.beginPublish(topic.c_str(), len, retained))
+        return false;
+    mqtt_client.write(payload, len);
+    if (!mqtt_client.endPublish())
+        return false;
+    mqtt_count(topic.length(), len);
+    return true;
+}
+
+bool mqtt_publish(const String &topic, const String &payload, bool retained)
+{
+    return mqtt_publish(topic, (const uint8_t *)payload.c_str(), payload.length(), retained);
+}
+
+/* serializes into a pool buffer instead of a String */
+bool mqtt_publish(const String &topic, JsonDocument &json, bool msgpack)
+{
+    size_t len = msgpack ? measureMsgPack(json) : measureJson(json);
+    char *buf = pool_get(MEM_MQTT, len + 1);
+    if (!buf)
+        return false;
+    if (msgpack)
+        serializeMsgPack(json, buf, len + 1);
+    else
+        serializeJson(json, buf, len + 1);
+    bool ret = mqtt_publish(topic, (const uint8_t *)buf, len);
+    pool_put(MEM_MQTT, buf);
+    return ret;
+}
+
+void mqtt_stats_update()
+{
+    static unsigned long last = 0;
+    static uint32_t last_publishes = 0, last_bytes = 0;
+    unsigned long now = millis();
+    if (now - last < 60000)
+        return;
+    float secs = (now - last) / 1000.0;
+    mqtt_stats.pub_per_s = (mqtt_stats.publishes - last_publishes) / secs;
+    mqtt_stats.bytes_per_s = (mqtt_stats.bytes - last_bytes) / secs;
+    last_publishes = mqtt_stats.publishes;
+    last_bytes = mqtt_stats.bytes;
+    last = now;
+}
 
 void check_repeatedjobs()
 {
+    /* PubSubClient keeps the pointer, so it must not point into config */
+    static String mqtt_server;
     /* Toggle the data rate fast/slow */
     unsigned long now = millis();
     if (now - last_switch > interval * 1000) {
         switchDataRate();
         last_switch = now;
     }
+    int32_t tune_hz;
+    float tune_bw;
+    if (config.auto_tune && tune_check(tune_hz, tune_bw))
+        tuneRadio(tune_hz, tune_bw);
+#ifdef RADIO_HAS_FEI
+    static bool afc = false;
+    if (radio_ok && config.auto_tune != afc) {
+        afc = config.auto_tune;
+        radio.setAFC(afc);
+        if (!afc)
+            tuneRadio(0, 125.0);
+        tune_reset(rx_offset_hz, rx_bandwidth);
+    }
+#endif
+    static bool connect_started = false;
+    if (mqtt_connecting)
+        return; /* the rest uses mqtt_client */
+    if (connect_started) {
+        connect_started = false;
+        if (mqtt_connect_ok) {
+            static bool first = true;
+            Serial.println("MQTT connected");
+            if (first)
+                boot_mark("mqtt");
+            /* discovery state restored from before the restart, the broker still has it */
+            if (!first || !snap_restored)
+                hass_reset();
+            first = false;
+            snap_restored = false;
+            cluster_connected();
+            qos_connected();
+            if (config.cluster)
+                mqtt_client.subscribe(CLUSTER_TOPIC "+");
+        } else
+            Serial.println("MQTT connect FAILED");
+    }
     if (config.changed) {
         Serial.println("MQTT config changed. Dis- and reconnecting...");
         config.changed = false;
         if (mqtt_ok)
             mqtt_client.disconnect();
         if (config.mqtt_server.length() > 0) {
-            const char *_server = config.mqtt_server.c_str();
-            mqtt_client.setServer(_server, config.mqtt_port);
+            mqtt_server = config.mqtt_server;
+            mqtt_client.setServer(mqtt_server.c_str(), config.mqtt_port);
             mqtt_server_set = true; /* to avoid trying connection with invalid settings */
         } else
             Serial.println("MQTT server name not configured");
         mqtt_client.setKeepAlive(60); /* same as python's paho.mqtt.client */
+        mqtt_client.setSocketTimeout(5); /* for the CONNACK, default 15 s */
+        /* the default of 256 bytes is too small for the summaries of other gateways */
+        mqtt_client.setBufferSize(config.cluster ? CLUSTER_BUF_SIZE : 256);
+        mqtt_client.setCallback(cluster_receive);
         Serial.print("MQTT SERVER: "); Serial.println(config.mqtt_server);
         Serial.print("MQTT PORT:   "); Serial.println(config.mqtt_port);
         last_reconnect = 0; /* trigger connect() */
     }
     if (!mqtt_client.connected() && now - last_reconnect > 5 * 1000) {
         if (mqtt_server_set) {
-            const char *user = NULL;
-            const char *pass = NULL;
-            if (config.mqtt_user.length()) {
-                user = config.mqtt_user.c_str();
-                pass = config.mqtt_pass.c_str();
+            /* copies, the web server may change config while connecting */
+            MqttConnect *c = new MqttConnect;
+            c->user = config.mqtt_user;
+            c->pass = config.mqtt_pass;
+            c->will = cluster_topic();
+            c->cluster = config.cluster;
+            Serial.println("MQTT RECONNECT...");
+            mqtt_connecting = true;
+            connect_started = true;
+            if (xTaskCreate(mqtt_connect_task, "mqtt", 4096, c, 1, NULL) != pdPASS) {
+                delete c;
+                mqtt_connecting = false;
+                mqtt_connect_ok = false;
             }
-            Serial.print("MQTT RECONNECT...");
-            if (mqtt_client.connect(mqtt_id.c_str(), user, pass)) {
-                Serial.println("OK!");
-                for (int i = 0; i < SENSOR_NUM; i++)
-                    hass_cfg[i] = 0;
-            } else
-                Serial.println("FAILED");
         }
         last_reconnect = now;
+        if (mqtt_connecting)
+            return;
     }
 #if 0
     if (now - last_display > 10000) /* update display at least every 10 seconds, even if nothing */
         update_display(NULL);       /* is received. Indicates that the thing is still alive ;-) */
 #endif
+    mqtt_client.loop(); /* keepalive and incoming messages */
     mqtt_ok = mqtt_client.connected();
+    mqtt_stats_update();
+    static String ntp_server;
+    if (wifi_state == STATE_CONN && config.ntp_server.length() > 0 && config.ntp_server != ntp_server) {
+        ntp_server = config.ntp_server;
+        Serial.println("NTP server: " + ntp_server);
+        configTime(0, 0, ntp_server.c_str());
+    }
 }
 
-void pub_hass_config(int what, byte ID)
+void publish_aggregates()
 {
-#define is_battery (what == 2)
-    static const char* const name[3] = { "Luftfeuchtigkeit", "Temperatur", "Batterie_schwach" };
-    static const char* const value[3] = { "humi", "temp", "batt_low" };
-    static const char* const dclass[3] = { "humidity", "temperature", "battery" };
-    static const char* const unit[2] = { "%", "°C" };
-    static const char* const mdi[2] = { "mdi:water-percent", "mdi:thermometer" };
-    String where = id2name[ID];
-
-    if (!config.ha_discovery)
-        return;
-
-    /* only send once */
-    if (hass_cfg[ID] & (1 << what))
-        return;
-    hass_cfg[ID] |= (1 << what);
-
-    JsonDocument cfg;
-    String msg;
-
-    String where_lower = where;
-    where_lower.toLowerCase();
-    /*
-     * mosquitto_pub -h server -t 'homeassistant/sensor/lacrosse2mqtt_aussen_temp/config' -m \
-     * '{
-          "state_class": "measurement",
-          "device_class": "temperature",
-          "state_topic":"climate/Aussen/temp",
-          "unique_id":"sensor.lacrosse2mqtt.aussen.temp",
-          "unit_of_measurement":"°C",
-          "name":"Temperatur Aussen",
-          "value_template":"{{ value }}"
-      }'
-     * {
-          "state_class": "measurement",
-          "device_class": "humidity",
-          "state_topic": "climate/Stube/humi",
-          "unique_id": "sensor.lacrosse2mqtt.stube.humi",
-          "unit_of_measurement": "%",
-          "name": "Luftfeuchtigkeit Stube2",
-          "value_template": "{{ value }}"
-       }
-     */
-    String uid = mqtt_id + "_" + where_lower + "_" + value[what];
-    String topic;
-    if (is_battery)
-        topic = String("homeassistant/binary_sensor/");
-    else
-        topic = hass_base;
-    topic += uid +  "/config";
-    cfg["device"]["identifiers"][0] = mqtt_id + "_" +where_lower;
-    cfg["device"]["name"] = where;
-    cfg["device"]["manufacturer"] = "Lacrosse2MQTT";
-    cfg["device"]["model"] = "esp32";
-    cfg["origin"]["name"] = "lacrosse2mqtt";
-    cfg["origin"]["url"] = "https://github.com/seife/lacrosse2mqtt";
-    if (! is_battery) {
-        cfg["state_class"] = "measurement";
-        cfg["unit_of_measurement"] = unit[what];
-        cfg["state_topic"] = pretty_base + where + "/" + value[what];
-        cfg["icon"] = mdi[what];
-    } else {
-        cfg["state_topic"] = pub_base + String(ID, DEC) + "/state";
-        cfg["value_template"] = "{{ value_json.low_batt }}";
-        cfg["payload_on"] = "true";   /* boolean does not seem to work, so we send a string */
-        cfg["payload_off"] = "false";
+    for (int w = 0; w < AGG_WINDOWS; w++) {
+        if (!agg_window_due(w))
+            continue;
+        String suffix;
+        for (int i = 0; i < SENSOR_NUM; i++) {
+            JsonDocument json(&json_pool);
+            if (!agg_render(w, i, suffix, json))
+                continue;
+            if (cluster_owns(i))
+                mqtt_publish(pub_base + String(i, DEC) + "/" + suffix, json);
+            agg_reset(w, i);
+        }
     }
-    cfg["device_class"] = dclass[what];
-    cfg["unique_id"] = uid;
-    cfg["name"] = name[what];
-    serializeJson(cfg, msg);
-
-    Serial.println(topic);
-    Serial.println(topic.length());
-    Serial.println(msg);
-    Serial.println(msg.length());
-    mqtt_client.beginPublish(topic.c_str(), msg.length(), true);
-    mqtt_client.print(msg);
-    mqtt_client.endPublish();
 }
 
 void expire_cache()
@@ -273,7 +399,7 @@ void expire_cache()
 }
 
 String wifi_disp;
-void update_display(LaCrosse::Frame *frame)
+void update_display(SensorFrame *frame)
 {
     char tmp[32];
     // last_display = millis();
@@ -301,8 +427,8 @@ void update_display(LaCrosse::Frame *frame)
 
     if (frame) {
         if (frame->valid) {
-            if (id2name[frame->ID].length() > 0) {
-                display.print(id2name[frame->ID]);
+            if (labels.has(frame->ID)) {
+                display.print(labels.get(frame->ID));
                 display.printf(" %.1fC", frame->temp);
             } else {
                 display.printf("id: %02d %.1fC", frame->ID, frame->temp);
@@ -332,25 +458,115 @@ void update_display(LaCrosse::Frame *frame)
     display.display();
 }
 
+/*
+ * Frames are read from the radio into this queue right away and decoded and
+ * published later from loop(). During startup, they are held back until MQTT
+ * is connected (or BOOT_HOLD_MS have passed), so the radio can start
+ * listening before WiFi, filesystem and MQTT are ready.
+ * Sensors repeat every 4 seconds, so during the hold the queue fills up with
+ * several frames per sensor. When it is full, a new frame replaces the newest
+ * queued one of the same sensor, only frames of sensors that are not queued
+ * yet push out the oldest frame.
+ */
+#define RXQ_LEN 64
+#define BOOT_HOLD_MS 15000
+struct RxFrame {
+    uint8_t data[FRAME_LENGTH];
+    int8_t rssi;
+    uint8_t rate_idx;       /* index into datarates_bps[] */
+    unsigned long ms;       /* millis() when it was read */
+    uint32_t isr_us;        /* esp_timer_get_time() of the interrupt */
+    uint32_t read_us;       /* esp_timer_get_time() when it was read */
+    int32_t offset_hz;      /* frequency error, relative to freq */
+    bool offset_ok;
+};
+static RxFrame rxq[RXQ_LEN];
+static uint8_t rxq_head, rxq_tail; /* head == tail => empty */
+uint32_t rxq_dropped;
+uint32_t rxq_merged;
+
+/* sensor ID of a frame, -1 if it can not be decoded */
+static int rxq_id(RxFrame *r)
+{
+    SensorFrame f;
+    f.rate = datarates_bps[r->rate_idx];
+    const Decoder *dec = decoder_find(r->data, FRAME_LENGTH, r->rate_idx);
+    if (!dec || !dec->TryHandleData(r->data, &f))
+        return -1;
+    return f.ID;
+}
+
+/* queue full: overwrite the newest queued frame of the same sensor with r */
+static bool rxq_merge(RxFrame *r)
+{
+    int id = rxq_id(r);
+    if (id < 0)
+        return false;
+    for (uint8_t i = rxq_head; i != rxq_tail; ) {
+        i = (i + RXQ_LEN - 1) % RXQ_LEN;
+        if (rxq_id(&rxq[i]) == id) {
+            rxq[i] = *r;
+            rxq_merged++;
+            return true;
+        }
+    }
+    return false;
+}
+
 void receive()
 {
+    static bool first = true;
     if (!receivedFlag)
         return;
     receivedFlag = false;
 
-    uint8_t payload[FRAME_LENGTH];
-    int16_t st = radio.readData(payload, FRAME_LENGTH);
+    RxFrame *r = &rxq[rxq_head];
+    r->isr_us = receivedTime;
+#ifdef RADIO_HAS_FEI
+    r->offset_hz = rx_offset_hz + (int32_t)radio.getFrequencyError();
+    r->offset_ok = config.auto_tune;
+#else
+    r->offset_ok = false;
+#endif
+    int16_t st = radio.readData(r->data, FRAME_LENGTH);
     if (st != RADIOLIB_ERR_NONE) {
         Serial.print(F(RADIO_NAME " readData failed: "));
         Serial.println(st);
         radio.startReceive();
         return;
     }
+    r->rssi = (int)radio.getRSSI();
+    r->rate_idx = currentRate;
+    r->ms = millis();
+    r->read_us = (uint32_t)esp_timer_get_time();
+    radio.startReceive();
 
-    digitalWrite(LED_BUILTIN, HIGH);
-    int rssi = (int)radio.getRSSI();
-    int rate = datarates_bps[currentRate];
+    uint8_t next = (rxq_head + 1) % RXQ_LEN;
+    if (next != rxq_tail)
+        rxq_head = next;
+    else if (!rxq_merge(r)) {
+        /* full, drop the oldest frame */
+        rxq_tail = (rxq_tail + 1) % RXQ_LEN;
+        rxq_head = next;
+        rxq_dropped++;
+    }
+    if (first) {
+        boot_mark("first_frame");
+        first = false;
+    }
+}
+
+void handle_frame(RxFrame *r)
+{
+    uint8_t *payload = r->data;
+    int rssi = r->rssi;
+    int rate = datarates_bps[r->rate_idx];
+    uint32_t start_us = (uint32_t)esp_timer_get_time();
+    /* recorded here, under the lock the web server reads them with, not in receive() */
+    lat_stage[LAT_IRQ].add(r->read_us - r->isr_us);
+    lat_stage[LAT_QUEUE].add(start_us - r->read_us);
 
+    digitalWrite(LED_BUILTIN, HIGH);
     if (DEBUG) {
         Serial.print("\nEnd receiving, HEX raw data: ");
         for (int i = 0; i < FRAME_LENGTH; i++) {
@@ -361,47 +577,52 @@ void receive()
     }
 
     /* check if it can be decoded */
-    LaCrosse::Frame frame;
+    SensorFrame frame;
     frame.rate = rate;
-    if (LaCrosse::TryHandleData(payload, &frame)) {
-        LaCrosse::Frame oldframe;
+    frame.valid = false;
+    frame.rx_us = r->isr_us;
+    const Decoder *dec = decoder_find(payload, FRAME_LENGTH, r->rate_idx);
+    if (dec && dec->TryHandleData(payload, &frame)) {
+        SensorFrame oldframe;
         byte ID = frame.ID;
-        LaCrosse::TryHandleData(fcache[ID].data, &oldframe);
+        oldframe.rate = rate;
+        /* plausibility filter: no jumps against the previous frame of the sensor */
+        bool has_old = fcache[ID].timestamp != 0 && dec->TryHandleData(fcache[ID].data, &oldframe);
+        bool temp_ok = !has_old || abs(oldframe.temp - frame.temp) <= 2.0;
+        bool humi_ok = frame.humi <= 100 && (!has_old || abs(oldframe.humi - frame.humi) <= 10);
         fcache[ID].rssi = rssi;
-        fcache[ID].timestamp = millis();
+        fcache[ID].timestamp = r->ms;
         memcpy(&fcache[ID].data, payload, FRAME_LENGTH);
         frame.rssi = rssi;
-        LaCrosse::DisplayFrame(payload, &frame);
-        String pub = pub_base + String(ID, DEC) + "/";
-        mqtt_client.publish((pub + "temp").c_str(), String(frame.temp, 1).c_str());
-        if (frame.humi <= 100)
-            mqtt_client.publish((pub + "humi").c_str(), String(frame.humi, DEC).c_str());
-        JsonDocument json;
-        String state;
-        json["low_batt"] = frame.batlo?"true":"false";
-        json["init"] = frame.init?"true":"false";
-        json["RSSI"] = rssi;
-        json["baud"] = rate / 1000.0;
-        serializeJson(json, state);
-        mqtt_client.publish((pub + "state").c_str(), state.c_str());
-        if (id2name[ID].length() > 0) {
-            pub = pretty_base + id2name[ID] + "/";
-            if (abs(oldframe.temp - frame.temp) > 2.0)
+        dec->DisplayFrame(payload, &frame);
+        agg_update(&frame, temp_ok, humi_ok);
+        tune_record(ID, r->offset_hz, r->offset_ok);
+        cluster_heard(ID, rssi);
+        bool owner = cluster_owns(ID); /* another gateway may receive it better */
+        uint32_t decoded_us = (uint32_t)esp_timer_get_time();
+        lat_stage[LAT_DECODE].add(decoded_us - start_us);
+        if (owner)
+            publish_frame(&frame);
+        if (owner && labels.has(ID)) {
+            String pub = pretty_base + labels.get(ID) + "/";
+            if (!temp_ok)
                 Serial.println(String("skipping invalid temp diff bigger than 2K: ") + String(oldframe.temp - frame.temp,1));
             else {
-                pub_hass_config(1, ID);
-                pub_hass_config(2, ID);
-                mqtt_client.publish((pub + "temp").c_str(), String(frame.temp, 1).c_str());
+                hass_request(ID, (1 << HASS_TEMP) | (1 << HASS_BATT));
+                mqtt_publish(pub + "temp", String(frame.temp, 1));
             }
             if (frame.humi <= 100) {
-                if (abs(oldframe.humi - frame.humi) > 10)
+                if (!humi_ok)
                     Serial.println(String("skipping invalid humi diff > 10%: ") + String(oldframe.humi - frame.humi, DEC));
                 else {
-                    pub_hass_config(0, ID);
-                    mqtt_client.publish((pub + "humi").c_str(), String(frame.humi, DEC).c_str());
+                    hass_request(ID, 1 << HASS_HUMI);
+                    mqtt_publish(pub + "humi", String(frame.humi, DEC));
                 }
             }
         }
+        uint32_t done_us = (uint32_t)esp_timer_get_time();
+        lat_stage[LAT_PUBLISH].add(done_us - decoded_us);
+        lat_stage[LAT_TOTAL].add(done_us - r->isr_us);
 
     } else {
         static unsigned long last;
@@ -411,30 +632,95 @@ void receive()
 
     update_display(&frame);
     digitalWrite(LED_BUILTIN, LOW);
-    radio.startReceive();
+}
+
+void process_frames()
+{
+    static bool holding = true;
+    static unsigned long boot_done_at = 0;
+    if (!boot_done)
+        return;
+    if (holding) {
+        if (boot_done_at == 0)
+            boot_done_at = millis();
+        if (!mqtt_ok && mqtt_server_set && millis() - boot_done_at < BOOT_HOLD_MS)
+            return;
+        holding = false;
+    }
+    /* held while connecting, so they are published once the broker is there */
+    if (mqtt_connecting)
+        return;
+    /* one frame per call, to get back to the radio quickly */
+    if (rxq_tail == rxq_head)
+        return;
+    handle_frame(&rxq[rxq_tail]);
+    rxq_tail = (rxq_tail + 1) % RXQ_LEN;
+}
+
+/* filesystem and config are loaded in the background while the radio is already running */
+void boot_task(void *)
+{
+    littlefs_ok = LittleFS.begin(FORMAT_LITTLEFS_IF_FAILED);
+    if (!littlefs_ok)
+        Serial.println("LittleFS Mount Failed");
+    boot_mark("littlefs");
+    setup_web(); /* also loads config from LittleFS */
+    boot_mark("config");
+    if (snap_restore())
+        boot_mark("snapshot");
+#ifdef DEBUG_DAVFS
+    tcp.begin();
+    dav.begin(&tcp, &LittleFS);
+    dav.setTransferStatusCallback([](const char* name, int percent, bool receive)
+    {
+        Serial.printf("%s: '%s': %d%%\n", receive ? "recv" : "send", name, percent);
+    });
+#endif
+    boot_done = true;
+    vTaskDelete(NULL);
 }
 
 void setup(void)
 {
     char tmp[32];
+    Serial.begin(115200);
+    boot_mark("setup");
     snprintf(tmp, 31, "lacrosse2mqtt_%06lX", (long)(ESP.getEfuseMac() >> 24));
     mqtt_id = String(tmp);
     config.mqtt_port = 1883; /* default */
-    Serial.begin(115200);
+    pinMode(KEY_BUILTIN, INPUT);
+    pinMode(LED_BUILTIN, OUTPUT);
+
+    /* radio first, so that no frames are missed while the rest starts up */
+    last_switch = millis();
+    Serial.print(F(RADIO_NAME " Initializing... "));
+    int state = radio.beginFSK(freq / 1000.0, datarates_kbps[0], 30.0, rx_bandwidth);
+    radio_ok = state == RADIOLIB_ERR_NONE;
+    if (radio_ok) {
+        Serial.println("OK");
+        // LaCrosse-specific configuration
+        radio.setCRC(0);                                    // LaCrosse has its own CRC-8
+        uint8_t syncWord[] = {0x2D, 0xD4};
+        radio.setSyncWord(syncWord, 2);
+        radio.fixedPacketLengthMode(FRAME_LENGTH);          // 5-byte fixed packets
+        radio.setPacketReceivedAction(onPacketReceived);
+
+        switchDataRate(0);                                  // sets initial rate + starts receive
+        boot_mark("radio");
+    } else
+        Serial.printf("***** %s init failed! code %d ****\n", RADIO_NAME, state);
+
     start_WiFi("lacrosse2mqtt");
-    littlefs_ok = LittleFS.begin(FORMAT_LITTLEFS_IF_FAILED);
-    if (!littlefs_ok)
-        Serial.println("LittleFS Mount Failed");
-    setup_web(); /* also loads config from LittleFS */
-    display_on = config.display_on;
+    boot_mark("wifi_start");
+    state_mutex = xSemaphoreCreateRecursiveMutex();
+    xTaskCreate(boot_task, "boot", 8192, NULL, 1, NULL);
+
 #if defined(WIFI_LoRa_32_V3)
     /* Heltec V3 board needs VEXT turned on to enable the oled */
     pinMode(Vext, OUTPUT);
     digitalWrite(Vext, LOW);
     delay(20);
 #endif
-    pinMode(KEY_BUILTIN, INPUT);
-    pinMode(LED_BUILTIN, OUTPUT);
     pinMode(OLED_RST, OUTPUT);
     digitalWrite(OLED_RST, LOW); // set GPIO16 low to reset OLED
     delay(50);
@@ -445,50 +731,25 @@ void setup(void)
     display.flipScreenVertically();
     display.setFont(ArialMT_Plain_10);
     display.setTextAlignment(TEXT_ALIGN_LEFT);
-
-    delay(1000); /* for Serial to really work */
+    boot_mark("display");
 
     Serial.println("TTGO LORA lacrosse2mqtt converter");
     Serial.println(mqtt_id);
 #if 0
-    Serial.println("LaCrosse::Frame Cache fcache id2name size: ");
+    Serial.println("LaCrosse::Frame Cache fcache labels size: ");
     Serial.println(sizeof(LaCrosse::Frame));
     Serial.println(sizeof(Cache));
     Serial.println(sizeof(fcache));
-    Serial.println(sizeof(id2name));
+    Serial.println(sizeof(labels));
 #endif
     display.drawString(0,0,"LaCrosse2mqtt");
     display.display();
 
-    last_switch = millis();
-
-    Serial.print(F(RADIO_NAME " Initializing... "));
-    int state = radio.beginFSK(freq / 1000.0, datarates_kbps[0], 30.0, 125.0);
-    if (state != RADIOLIB_ERR_NONE) {
-        Serial.printf("***** %s init failed! code %d ****\n", RADIO_NAME, state);
+    /* no frames, but WiFi and the web server keep running, the status shows the failure */
+    if (!radio_ok) {
         display.drawString(0, 24, RADIO_NAME " init failed!");
         display.display();
-        while(true) delay(1000);
     }
-    Serial.println("OK");
-
-    // LaCrosse-specific configuration
-    radio.setCRC(0);                                    // LaCrosse has its own CRC-8
-    uint8_t syncWord[] = {0x2D, 0xD4};
-    radio.setSyncWord(syncWord, 2);
-    radio.fixedPacketLengthMode(FRAME_LENGTH);          // 5-byte fixed packets
-    radio.setPacketReceivedAction(onPacketReceived);
-
-    switchDataRate(0);                                  // sets initial rate + starts receive
-
-#ifdef DEBUG_DAVFS
-    tcp.begin();
-    dav.begin(&tcp, &LittleFS);
-    dav.setTransferStatusCallback([](const char* name, int percent, bool receive)
-    {
-        Serial.printf("%s: '%s': %d%%\n", receive ? "recv" : "send", name, percent);
-    });
-#endif
 }
 
 uint32_t check_button()
@@ -512,9 +773,17 @@ uint32_t check_button()
 static int last_state = -1;
 void loop(void)
 {
-    handle_client();
+    static bool was_done = false;
+    if (boot_done && !was_done) {
+        was_done = true;
+        display_on = config.display_on;
+        start_web();
+        boot_mark("ready");
+    }
+    receive();
 #ifdef DEBUG_DAVFS
-    dav.handleClient();
+    if (boot_done)
+        dav.handleClient();
 #endif
     uint32_t button_time = check_button();
     if (button_time > 0) {
@@ -536,9 +805,24 @@ void loop(void)
         update_display(NULL);
     }
 
+#ifdef SIMULATE_RADIO
+    radio.poll();
+#endif
     receive();
-    check_repeatedjobs();
-    expire_cache();
+    if (boot_done) {
+        lock_state();
+        check_repeatedjobs();
+        process_frames();
+        flush_batch();
+        hass_job();
+        cluster_job();
+        qos_job();
+        snap_job();
+        publish_aggregates();
+        expire_cache();
+        unlock_state();
+        web_job();
+    }
     if (last_state != wifi_state) {
         last_state = wifi_state;
         wifi_disp = String(_wifi_state_str[wifi_state]);
@@ -0,0 +1,51 @@
+#include "latency.h"
+#include <sys/time.h>
+
+LatencyStats lat_stage[LAT_STAGES];
+const char * const lat_stage_name[LAT_STAGES] = { "irq", "queue", "decode", "publish", "total" };
+
+void LatencyStats::add(uint32_t us)
+{
+    _samples[_next] = us;
+    _next = (_next + 1) % LAT_SAMPLES;
+    _count++;
+}
+
+/* p in percent, sorts a copy of the samples, so do not call it from the receive path */
+uint32_t LatencyStats::percentile(int p)
+{
+    uint32_t tmp[LAT_SAMPLES];
+    int n = (_count < LAT_SAMPLES) ? _count : LAT_SAMPLES;
+    if (n == 0)
+        return 0;
+    memcpy(tmp, _samples, n * sizeof(uint32_t));
+    std::sort(tmp, tmp + n);
+    int idx = (n * p + 99) / 100 - 1;
+    if (idx < 0)
+        idx = 0;
+    return tmp[idx];
+}
+
+void LatencyStats::to_json(JsonObject obj)
+{
+    obj["count"] = _count;
+    obj["p50_ms"] = percentile(50) / 1000.0;
+    obj["p99_ms"] = percentile(99) / 1000.0;
+}
+
+/* true if the time has been set via SNTP */
+bool wallclock_ok()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec > 1700000000;
+}
+
+/* convert an esp_timer_get_time() based timestamp to wall clock milliseconds */
+uint64_t wallclock_ms(uint32_t us)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    uint32_t age = (uint32_t)esp_timer_get_time() - us;
+    return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000 - age / 1000;
+}
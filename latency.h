@@ -0,0 +1,39 @@
+#ifndef _LATENCY_H
+#define _LATENCY_H
+
+#include "Arduino.h"
+#include <ArduinoJson.h>
+
+/* number of samples kept for the rolling percentiles */
+#define LAT_SAMPLES 64
+
+/* rolling latency statistics over the last LAT_SAMPLES samples, in microseconds */
+class LatencyStats {
+public:
+    void add(uint32_t us);
+    uint32_t percentile(int p);
+    uint32_t count() { return _count; }
+    void to_json(JsonObject obj);
+private:
+    uint32_t _samples[LAT_SAMPLES];
+    uint8_t _next;
+    uint32_t _count;
+};
+
+/* processing stages of a received frame */
+enum {
+    LAT_IRQ = 0,    /* radio interrupt until frame read from the radio */
+    LAT_QUEUE,      /* waiting in the receive queue */
+    LAT_DECODE,     /* decoding and plausibility filter */
+    LAT_PUBLISH,    /* MQTT publishing */
+    LAT_TOTAL,      /* radio interrupt until published */
+    LAT_STAGES
+};
+
+extern LatencyStats lat_stage[LAT_STAGES];
+extern const char * const lat_stage_name[LAT_STAGES];
+
+bool wallclock_ok();
+uint64_t wallclock_ms(uint32_t us);
+
+#endif
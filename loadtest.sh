@@ -0,0 +1,50 @@
+#!/bin/bash
+#
+# loadtest.sh <hostname> [clients] [requests]
+# fetches the pages and the JSON API from several clients in parallel and
+# reports the response times, the 503 Busy answers and the frames lost by
+# the receive queue during the test.
+
+if [ -z "$1" ]; then
+	echo "usage: ${0##*/} <hostname> [clients] [requests]"
+	exit 1
+fi
+HOST=$1
+CLIENTS=${2:-8}
+REQUESTS=${3:-400}
+URLS=(/ /api/data.json /api/status.json /config.html)
+
+radio_counter() { # $1: name, from /api/status.json
+	curl -s "http://$HOST/api/status.json" | grep -o "\"$1\": *[0-9]*" | grep -o "[0-9]*$"
+}
+
+DROPPED=$(radio_counter frames_dropped)
+MERGED=$(radio_counter frames_merged)
+if [ -z "$DROPPED" ]; then
+	echo "no status from $HOST"
+	exit 1
+fi
+
+OUT=$(mktemp)
+trap 'rm -f "$OUT"' EXIT
+for ((i = 0; i < REQUESTS; i++)); do
+	echo "http://$HOST${URLS[i % ${#URLS[@]}]}"
+done | xargs -P "$CLIENTS" -n 1 curl -s -o /dev/null -w "%{http_code} %{time_total}\n" > "$OUT"
+
+# wait for the 503 answers to pass before reading the counters again
+sleep 2
+DROPPED=$(($(radio_counter frames_dropped) - DROPPED))
+MERGED=$(($(radio_counter frames_merged) - MERGED))
+
+echo "$REQUESTS requests, $CLIENTS clients:"
+awk '{ n[$1]++ } END { for (c in n) printf "  HTTP %s: %d\n", c, n[c] }' "$OUT"
+awk '$1 == 200 { print $2 }' "$OUT" | sort -n | awk '
+	{ t[NR] = $1 }
+	END {
+		if (NR == 0) exit
+		p99 = int(NR * 0.99 + 0.5)
+		if (p99 < 1) p99 = 1
+		printf "  time (200 only): median %.3f s, 99%% %.3f s, max %.3f s\n",
+			t[int((NR + 1) / 2)], t[p99], t[NR]
+	}'
+echo "  frames dropped: $DROPPED, merged: $MERGED"
@@ -0,0 +1,116 @@
+#include "mempool.h"
+
+#define JSON_POOL_SIZE      4096
+/* block header, keeps the payload 8 byte aligned */
+#define HDR 8
+#define ALIGN(x) (((x) + 7) & ~7)
+
+MemStats mem_stats[MEM_SUBSYS];
+const char * const mem_subsys_name[MEM_SUBSYS] = { "web", "mqtt", "json", "hass" };
+
+static char pool_mem[POOL_BUF_NUM][POOL_BUF_SIZE];
+static uint8_t pool_used; /* bitmask */
+
+static uint8_t json_mem[JSON_POOL_SIZE] __attribute__((aligned(8)));
+JsonPool json_pool(json_mem, sizeof(json_mem), MEM_JSON);
+
+static void account(int subsys, int32_t delta)
+{
+    mem_stats[subsys].in_use += delta;
+    if (mem_stats[subsys].in_use > mem_stats[subsys].peak)
+        mem_stats[subsys].peak = mem_stats[subsys].in_use;
+}
+
+/* for subsystems that use the heap directly, size < 0 for free() */
+void mem_account_heap(int subsys, int32_t size)
+{
+    if (size > 0)
+        mem_stats[subsys].allocs++;
+    account(subsys, size);
+}
+
+char *pool_get(int subsys, size_t size)
+{
+    mem_stats[subsys].allocs++;
+    if (size <= POOL_BUF_SIZE) {
+        for (int i = 0; i < POOL_BUF_NUM; i++) {
+            if (pool_used & (1 << i))
+                continue;
+            pool_used |= (1 << i);
+            account(subsys, POOL_BUF_SIZE);
+            return pool_mem[i];
+        }
+    }
+    mem_stats[subsys].fallbacks++;
+    return (char *)malloc(size);
+}
+
+void pool_put(int subsys, char *buf)
+{
+    if (!buf)
+        return;
+    for (int i = 0; i < POOL_BUF_NUM; i++) {
+        if (buf == pool_mem[i]) {
+            pool_used &= ~(1 << i);
+            account(subsys, -POOL_BUF_SIZE);
+            return;
+        }
+    }
+    free(buf);
+}
+
+void *JsonPool::allocate(size_t size)
+{
+    size_t sz = ALIGN(size);
+    mem_stats[_subsys].allocs++;
+    if (_used + HDR + sz > _size) {
+        mem_stats[_subsys].fallbacks++;
+        return malloc(size);
+    }
+    *(uint32_t *)(_buf + _used) = sz;
+    _last = _used;
+    _used += HDR + sz;
+    _live++;
+    account(_subsys, HDR + sz);
+    return _buf + _last + HDR;
+}
+
+void JsonPool::deallocate(void *ptr)
+{
+    if (!owns(ptr)) {
+        free(ptr);
+        return;
+    }
+    if (--_live > 0)
+        return;
+    /* last block gone => whole arena is free again */
+    account(_subsys, -(int32_t)_used);
+    _used = 0;
+    _last = 0;
+}
+
+void *JsonPool::reallocate(void *ptr, size_t new_size)
+{
+    if (!ptr)
+        return allocate(new_size);
+    if (!owns(ptr))
+        return realloc(ptr, new_size);
+    uint8_t *hdr = (uint8_t *)ptr - HDR;
+    size_t old = *(uint32_t *)hdr;
+    size_t sz = ALIGN(new_size);
+    /* the last block can grow or shrink in place */
+    if (hdr == _buf + _last && _last + HDR + sz <= _size) {
+        account(_subsys, (int32_t)sz - (int32_t)old);
+        *(uint32_t *)hdr = sz;
+        _used = _last + HDR + sz;
+        return ptr;
+    }
+    if (sz <= old)
+        return ptr;
+    void *n = allocate(new_size);
+    if (!n)
+        return NULL;
+    memcpy(n, ptr, old);
+    deallocate(ptr);
+    return n;
+}
@@ -0,0 +1,64 @@
+#ifndef _MEMPOOL_H
+#define _MEMPOOL_H
+
+#include "Arduino.h"
+#include <ArduinoJson.h>
+
+/*
+ * Fixed buffers for the recurring allocations (HTTP response chunks, MQTT
+ * payloads, JSON scratch documents). They live in .bss, so they do not
+ * fragment the heap. If a pool is exhausted or a request is too big, the
+ * heap is used instead and counted as a fallback.
+ */
+
+/* subsystems for the allocation statistics */
+enum {
+    MEM_WEB = 0,    /* HTTP response buffers and web JSON documents */
+    MEM_MQTT,       /* MQTT payload buffers */
+    MEM_JSON,       /* JSON scratch documents in the receive path */
+    MEM_HASS,       /* Home Assistant discovery cache */
+    MEM_SUBSYS
+};
+
+struct MemStats {
+    uint32_t allocs;    /* number of allocations */
+    uint32_t fallbacks; /* allocations that had to go to the heap */
+    uint32_t in_use;    /* bytes currently used from the pool */
+    uint32_t peak;      /* maximum of in_use */
+};
+
+extern MemStats mem_stats[MEM_SUBSYS];
+extern const char * const mem_subsys_name[MEM_SUBSYS];
+
+/* one TCP segment */
+#define POOL_BUF_SIZE 1460
+#define POOL_BUF_NUM  4
+
+char *pool_get(int subsys, size_t size = POOL_BUF_SIZE);
+void pool_put(int subsys, char *buf);
+void mem_account_heap(int subsys, int32_t size);
+
+/*
+ * ArduinoJson allocator on a fixed arena. Allocation is a pointer bump,
+ * the arena is reset when the last block is released, so it is meant for
+ * short lived documents only.
+ */
+class JsonPool : public ArduinoJson::Allocator {
+public:
+    JsonPool(uint8_t *buf, size_t size, int subsys) : _buf(buf), _size(size), _used(0), _last(0), _live(0), _subsys(subsys) {}
+    void *allocate(size_t size) override;
+    void deallocate(void *ptr) override;
+    void *reallocate(void *ptr, size_t new_size) override;
+private:
+    bool owns(void *ptr) { return (uint8_t *)ptr >= _buf && (uint8_t *)ptr < _buf + _size; }
+    uint8_t *_buf;
+    size_t _size;
+    size_t _used;
+    size_t _last;   /* offset of the last block's header */
+    int _live;      /* number of blocks not yet released */
+    int _subsys;
+};
+
+extern JsonPool json_pool;      /* receive path and MQTT, the web frontend has one per request (webrequest.h) */
+
+#endif
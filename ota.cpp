@@ -0,0 +1,221 @@
+#include "ota.h"
+#include <Update.h>
+#include "rom/miniz.h"
+
+/* the start of the image is collected until the format and the gzip header are known */
+#define OTA_HEAD_MAX 512
+
+enum {
+    OTA_IDLE = 0,
+    OTA_DETECT,     /* waiting for the first bytes to detect the format */
+    OTA_RAW,
+    OTA_INFLATE,
+    OTA_DONE,
+    OTA_ERROR
+};
+
+static int ota_state = OTA_IDLE;
+static tinfl_decompressor *inflator;
+static uint8_t *dict;       /* TINFL_LZ_DICT_SIZE bytes, wrapping output window */
+static size_t dict_ofs;
+static uint8_t *head;       /* OTA_HEAD_MAX bytes */
+static size_t head_len;
+static uint32_t inflate_flags;
+static String ota_md5;
+static String ota_msg;
+
+static uint32_t start_ms;
+static uint32_t bytes_in;       /* as uploaded */
+static uint32_t bytes_out;      /* written to flash */
+static uint32_t flash_us;       /* time spent in Update.write() */
+
+static void ota_free()
+{
+    free(inflator);
+    free(dict);
+    free(head);
+    inflator = NULL;
+    dict = NULL;
+    head = NULL;
+}
+
+static bool ota_fail(const String &why)
+{
+    ota_msg = "Update failed: " + why;
+    Serial.println(ota_msg);
+    if (Update.isRunning())
+        Update.abort();
+    ota_free();
+    ota_state = OTA_ERROR;
+    return false;
+}
+
+static bool flash_write(uint8_t *data, size_t len)
+{
+    uint32_t t = micros();
+    size_t n = Update.write(data, len);
+    flash_us += micros() - t;
+    if (n != len)
+        return ota_fail(String("flash write: ") + Update.errorString());
+    bytes_out += len;
+    return true;
+}
+
+/* skip the gzip header, returns its length or 0 if it is not complete */
+static size_t gzip_header_len(const uint8_t *p, size_t len)
+{
+    if (len < 10)
+        return 0;
+    uint8_t flg = p[3];
+    size_t i = 10;
+    if (flg & 0x04) { /* FEXTRA */
+        if (i + 2 > len)
+            return 0;
+        i += 2 + (p[i] | (p[i + 1] << 8));
+    }
+    if (flg & 0x08) { /* FNAME */
+        while (i < len && p[i])
+            i++;
+        i++;
+    }
+    if (flg & 0x10) { /* FCOMMENT */
+        while (i < len && p[i])
+            i++;
+        i++;
+    }
+    if (flg & 0x02) /* FHCRC */
+        i += 2;
+    return (i <= len) ? i : 0;
+}
+
+bool ota_begin(const String &md5)
+{
+    ota_free();
+    ota_md5 = md5;
+    ota_msg = String();
+    start_ms = millis();
+    bytes_in = bytes_out = flash_us = 0;
+    dict_ofs = 0;
+    head_len = 0;
+    head = (uint8_t *)malloc(OTA_HEAD_MAX);
+    if (!head)
+        return ota_fail("out of memory");
+    if (!Update.begin(UPDATE_SIZE_UNKNOWN))
+        return ota_fail(String("begin: ") + Update.errorString());
+    if (md5.length() == 32)
+        Update.setMD5(md5.c_str());
+    ota_state = OTA_DETECT;
+    Serial.println("Update started, md5: " + (md5.length() ? md5 : String("none")));
+    return true;
+}
+
+static bool inflate(const uint8_t *data, size_t len)
+{
+    tinfl_status st;
+    do {
+        size_t in_bytes = len;
+        size_t out_bytes = TINFL_LZ_DICT_SIZE - dict_ofs;
+        st = tinfl_decompress(inflator, data, &in_bytes, dict, dict + dict_ofs, &out_bytes,
+                              inflate_flags | TINFL_FLAG_HAS_MORE_INPUT);
+        data += in_bytes;
+        len -= in_bytes;
+        if (out_bytes > 0 && !flash_write(dict + dict_ofs, out_bytes))
+            return false;
+        dict_ofs = (dict_ofs + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+        if (st < TINFL_STATUS_DONE)
+            return ota_fail(String("inflate error ") + String((int)st));
+        if (st == TINFL_STATUS_DONE) {
+            /* anything after this is the gzip / zlib trailer */
+            ota_state = OTA_DONE;
+            return true;
+        }
+    } while (len > 0 || st == TINFL_STATUS_HAS_MORE_OUTPUT);
+    return true;
+}
+
+bool ota_write(const uint8_t *data, size_t len)
+{
+    bytes_in += len;
+    switch (ota_state) {
+        case OTA_DETECT: {
+            /* the first chunks can be very short, so the start of the image is collected in head[] */
+            size_t n = std::min(len, (size_t)OTA_HEAD_MAX - head_len);
+            memcpy(head + head_len, data, n);
+            head_len += n;
+            data += n;
+            len -= n;
+            if (head_len < 2)
+                return true;
+            size_t skip = 0;
+            if (head[0] == 0x1f && head[1] == 0x8b) {
+                if (head_len >= 3 && head[2] != 8) /* CM must be deflate */
+                    return ota_fail("invalid gzip header");
+                skip = gzip_header_len(head, head_len);
+                if (skip == 0) {
+                    if (head_len == OTA_HEAD_MAX)
+                        return ota_fail("gzip header too long");
+                    return true;
+                }
+                inflate_flags = 0;
+            } else if ((head[0] & 0x0f) == 8 && ((head[0] << 8) | head[1]) % 31 == 0) {
+                inflate_flags = TINFL_FLAG_PARSE_ZLIB_HEADER;
+            } else {
+                ota_state = OTA_RAW;
+                return flash_write(head, head_len) && (len == 0 || flash_write((uint8_t *)data, len));
+            }
+            if (ota_md5.length() != 32)
+                return ota_fail("compressed image needs md5");
+            inflator = (tinfl_decompressor *)malloc(sizeof(tinfl_decompressor));
+            dict = (uint8_t *)malloc(TINFL_LZ_DICT_SIZE);
+            if (!inflator || !dict)
+                return ota_fail("out of memory");
+            tinfl_init(inflator);
+            ota_state = OTA_INFLATE;
+            Serial.println(inflate_flags ? "Update: zlib compressed image" : "Update: gzip compressed image");
+            if (!inflate(head + skip, head_len - skip))
+                return false;
+            return len == 0 || ota_state != OTA_INFLATE || inflate(data, len);
+        }
+        case OTA_RAW:
+            return flash_write((uint8_t *)data, len);
+        case OTA_INFLATE:
+            return inflate(data, len);
+        case OTA_DONE: /* trailer */
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool ota_end()
+{
+    if (ota_state == OTA_ERROR)
+        return false; /* keep the reason in ota_msg */
+    if (ota_state == OTA_INFLATE)
+        return ota_fail("compressed image is truncated");
+    if (ota_state != OTA_RAW && ota_state != OTA_DONE)
+        return ota_fail("no image");
+    ota_free();
+    /* checks the md5, if one was given, before switching the boot partition */
+    if (!Update.end(true))
+        return ota_fail(Update.errorString());
+    uint32_t ms = millis() - start_ms;
+    if (ms == 0)
+        ms = 1;
+    ota_msg = "Update OK: received " + String(bytes_in) + " bytes in " + String(ms) + " ms (" +
+              String(bytes_in / (float)ms, 1) + " kB/s), wrote " + String(bytes_out) + " bytes to flash (" +
+              String(flash_us ? bytes_out * 1000.0 / flash_us : 0.0, 1) + " kB/s)";
+    Serial.println(ota_msg);
+    ota_state = OTA_IDLE;
+    return true;
+}
+
+void ota_abort()
+{
+    ota_fail("aborted");
+}
+
+String ota_status()
+{
+    return ota_msg;
+}
@@ -0,0 +1,20 @@
+#ifndef _OTA_H
+#define _OTA_H
+
+#include "Arduino.h"
+
+/*
+ * Firmware update from a stream of upload chunks.
+ * Plain images are written as they are, gzip (RFC 1952) or zlib (RFC 1950)
+ * compressed images are inflated on the fly with a 32 kB window.
+ * If a MD5 of the uncompressed image is given, it is checked before the
+ * new partition is made bootable.
+ */
+bool ota_begin(const String &md5);
+bool ota_write(const uint8_t *data, size_t len);
+bool ota_end();
+void ota_abort();
+/* result / throughput of the last update */
+String ota_status();
+
+#endif
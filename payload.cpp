@@ -0,0 +1,103 @@
+#include "payload.h"
+#include "mempool.h"
+#include "latency.h"
+
+static const String batch_topic = "lacrosse/batch/";
+static JsonDocument batch;
+static unsigned long batch_start;
+/* the queue time of batched frames is filled in when the batch is sent */
+static uint32_t batch_rx_us[SENSOR_NUM];
+static uint8_t batch_ids[SENSOR_NUM / 8];
+
+static const char *queue_key()
+{
+    return config.payload_mode == PAYLOAD_MSGPACK ? "q" : "queue_ms";
+}
+
+/* receive time and time spent inside the gateway so far, k_queue == NULL: no queue time */
+static void add_timing(JsonObject json, SensorFrame *f, const char *k_time, const char *k_queue)
+{
+    if (wallclock_ok())
+        json[k_time] = wallclock_ms(f->rx_us);
+    if (k_queue)
+        json[k_queue] = ((uint32_t)esp_timer_get_time() - f->rx_us) / 1000;
+}
+
+/* fill in the values of one frame for the consolidated payload modes */
+static void frame_to_json(JsonObject json, SensorFrame *f, bool batched)
+{
+    if (config.payload_mode == PAYLOAD_MSGPACK) {
+        /* short keys and temperature in 1/10 degrees to keep the record small */
+        json["t"] = (int)lroundf(f->temp * 10);
+        if (f->humi <= 100)
+            json["h"] = f->humi;
+        json["b"] = f->batlo;
+        json["i"] = f->init;
+        json["r"] = f->rssi;
+        json["d"] = f->rate;
+        add_timing(json, f, "ts", batched ? NULL : queue_key());
+        return;
+    }
+    json["temp"] = serialized(String(f->temp, 1));
+    if (f->humi <= 100)
+        json["humi"] = f->humi;
+    json["low_batt"] = f->batlo?"true":"false";
+    json["init"] = f->init?"true":"false";
+    json["RSSI"] = f->rssi;
+    json["baud"] = f->rate / 1000.0;
+    add_timing(json, f, "rx_time", batched ? NULL : queue_key());
+}
+
+static void publish_json(const String &topic, JsonDocument &json)
+{
+    if (config.payload_mode == PAYLOAD_MSGPACK)
+        mqtt_publish(topic + "msgpack", json, true);
+    else
+        mqtt_publish(topic + "data", json);
+}
+
+void publish_frame(SensorFrame *f)
+{
+    String pub = pub_base + String(f->ID, DEC) + "/";
+    if (config.payload_mode == PAYLOAD_TOPICS) {
+        mqtt_publish(pub + "temp", String(f->temp, 1));
+        if (f->humi <= 100)
+            mqtt_publish(pub + "humi", String(f->humi, DEC));
+        JsonDocument json(&json_pool);
+        json["low_batt"] = f->batlo?"true":"false";
+        json["init"] = f->init?"true":"false";
+        json["RSSI"] = f->rssi;
+        json["baud"] = f->rate / 1000.0;
+        add_timing(json.as<JsonObject>(), f, "rx_time", "queue_ms");
+        mqtt_publish(pub + "state", json);
+        return;
+    }
+    if (config.batch_ms > 0) {
+        if (batch.size() == 0)
+            batch_start = millis();
+        frame_to_json(batch[String(f->ID, DEC)].to<JsonObject>(), f, true);
+        batch_rx_us[f->ID] = f->rx_us;
+        batch_ids[f->ID / 8] |= 1 << (f->ID % 8);
+        return;
+    }
+    JsonDocument json(&json_pool);
+    frame_to_json(json.to<JsonObject>(), f, false);
+    publish_json(pub, json);
+}
+
+/* send all frames collected during the last batch_ms milliseconds as one message */
+void flush_batch()
+{
+    if (batch.size() == 0)
+        return;
+    if (config.batch_ms > 0 && millis() - batch_start < config.batch_ms)
+        return;
+    uint32_t now = (uint32_t)esp_timer_get_time();
+    for (int ID = 0; ID < SENSOR_NUM; ID++) {
+        if (batch_ids[ID / 8] & (1 << (ID % 8)))
+            batch[String(ID, DEC)][queue_key()] = (now - batch_rx_us[ID]) / 1000;
+    }
+    publish_json(batch_topic, batch);
+    batch.clear();
+    memset(batch_ids, 0, sizeof(batch_ids));
+}
@@ -0,0 +1,17 @@
+#ifndef _PAYLOAD_H
+#define _PAYLOAD_H
+
+#include "Arduino.h"
+#include "globals.h"
+#include "decoder.h"
+
+/*
+ * The per ID topics of a frame, in the layout selected by config.payload_mode:
+ * one topic per value, one JSON object or one MessagePack record per frame.
+ * With config.batch_ms, the JSON / MessagePack records of all sensors are
+ * collected and sent as one message by flush_batch().
+ */
+void publish_frame(SensorFrame *f);
+void flush_batch();
+
+#endif
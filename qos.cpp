@@ -0,0 +1,304 @@
+#include "qos.h"
+#include "mempool.h"
+#include "latency.h"
+
+#define MQTT_PUBLISH 3
+#define MQTT_PUBACK  4
+
+/* packet IDs used here, PubSubClient counts up from 1 for its SUBSCRIBEs */
+#define QOS_ID_FIRST 0x8000
+
+enum {
+    RX_HEADER = 0,
+    RX_LENGTH,
+    RX_BODY
+};
+
+enum {
+    SLOT_FREE = 0,
+    SLOT_QUEUED,    /* waiting for the window or for the older message of the topic */
+    SLOT_INFLIGHT   /* sent, waiting for PUBACK */
+};
+
+struct QosSlot {
+    uint8_t state;
+    uint8_t tries;          /* transmissions so far */
+    uint16_t id;
+    uint16_t topic_len;
+    uint16_t len;           /* payload */
+    uint32_t first_us;      /* esp_timer_get_time() of the first transmission */
+    uint32_t seq;           /* order in which the waiting messages were queued */
+    unsigned long sent;     /* millis() of the last transmission */
+    char buf[QOS_MSG_MAX];  /* topic, payload */
+};
+
+struct QosStats {
+    uint32_t sent;          /* messages sent for the first time */
+    uint32_t acked;
+    uint32_t retransmits;
+    uint32_t expired;       /* dropped after QOS_MAX_TRIES */
+    uint32_t overflow;      /* waiting message of another topic dropped, table full */
+    uint32_t replaced;      /* waiting message replaced by a newer value of the topic */
+    uint32_t downgraded;    /* sent with QoS 0, table full */
+};
+
+MqttLink mqtt_link;
+static QosSlot slots[QOS_SLOTS];
+static QosStats qos_stats;
+static LatencyStats ack_latency;
+static uint16_t next_id = QOS_ID_FIRST;
+static uint32_t next_seq;
+
+int MqttLink::read()
+{
+    int c = _client.read();
+    if (c >= 0)
+        sniff(c);
+    return c;
+}
+
+int MqttLink::read(uint8_t *buf, size_t size)
+{
+    int n = _client.read(buf, size);
+    for (int i = 0; i < n; i++)
+        sniff(buf[i]);
+    return n;
+}
+
+static void qos_acked(uint16_t id);
+
+void MqttLink::sniff(uint8_t c)
+{
+    switch (_state) {
+        case RX_HEADER:
+            _type = c >> 4;
+            _len = 0;
+            _shift = 0;
+            _state = RX_LENGTH;
+            break;
+        case RX_LENGTH:
+            _len |= (uint32_t)(c & 0x7f) << _shift;
+            _shift += 7;
+            if (c & 0x80)
+                break;
+            _pos = 0;
+            _id = 0;
+            _state = _len ? RX_BODY : RX_HEADER;
+            break;
+        case RX_BODY:
+            if (_pos < 2)
+                _id = (_id << 8) | c;
+            if (++_pos < _len)
+                break;
+            if (_type == MQTT_PUBACK && _len == 2)
+                qos_acked(_id);
+            _state = RX_HEADER;
+            break;
+    }
+}
+
+static int window()
+{
+    return constrain(config.qos_window, 1, QOS_SLOTS);
+}
+
+static bool same_topic(const QosSlot *a, const QosSlot *b)
+{
+    return a->topic_len == b->topic_len && memcmp(a->buf, b->buf, a->topic_len) == 0;
+}
+
+static uint16_t alloc_id()
+{
+    for (;;) {
+        uint16_t id = next_id++;
+        if (next_id == 0)
+            next_id = QOS_ID_FIRST;
+        bool used = false;
+        for (int i = 0; i < QOS_SLOTS; i++)
+            if (slots[i].state == SLOT_INFLIGHT && slots[i].id == id)
+                used = true;
+        if (!used)
+            return id;
+    }
+}
+
+/* write one PUBLISH packet with QoS 1 */
+static bool transmit(QosSlot *s)
+{
+    bool dup = s->tries > 0;
+    unsigned int rem = 2 + s->topic_len + 2 + s->len;
+    char *pkt = pool_get(MEM_MQTT, 5 + rem);
+    if (!pkt)
+        return false;
+    unsigned int n = 0;
+    pkt[n++] = (MQTT_PUBLISH << 4) | (dup ? 0x08 : 0) | (1 << 1);
+    unsigned int r = rem;
+    do {
+        uint8_t b = r & 0x7f;
+        r >>= 7;
+        pkt[n++] = b | (r ? 0x80 : 0);
+    } while (r);
+    pkt[n++] = s->topic_len >> 8;
+    pkt[n++] = s->topic_len & 0xff;
+    memcpy(pkt + n, s->buf, s->topic_len);
+    n += s->topic_len;
+    pkt[n++] = s->id >> 8;
+    pkt[n++] = s->id & 0xff;
+    memcpy(pkt + n, s->buf + s->topic_len, s->len);
+    n += s->len;
+    bool ok = mqtt_link.write((const uint8_t *)pkt, n) == n;
+    pool_put(MEM_MQTT, pkt);
+    if (!ok)
+        return false;
+    mqtt_count(s->topic_len, s->len + 2);
+    if (dup)
+        qos_stats.retransmits++;
+    else {
+        qos_stats.sent++;
+        s->first_us = (uint32_t)esp_timer_get_time();
+    }
+    s->tries++;
+    s->sent = millis();
+    return true;
+}
+
+static void qos_acked(uint16_t id)
+{
+    for (int i = 0; i < QOS_SLOTS; i++) {
+        QosSlot *s = &slots[i];
+        if (s->state != SLOT_INFLIGHT || s->id != id)
+            continue;
+        ack_latency.add((uint32_t)esp_timer_get_time() - s->first_us);
+        qos_stats.acked++;
+        s->state = SLOT_FREE;
+        return;
+    }
+}
+
+/* send waiting messages, as far as the window allows */
+static void send_queued()
+{
+    if (!mqtt_ok)
+        return;
+    int inflight = 0;
+    for (int i = 0; i < QOS_SLOTS; i++)
+        if (slots[i].state == SLOT_INFLIGHT)
+            inflight++;
+    for (int i = 0; i < QOS_SLOTS && inflight < window(); i++) {
+        QosSlot *s = &slots[i];
+        if (s->state != SLOT_QUEUED)
+            continue;
+        bool busy = false;
+        for (int j = 0; j < QOS_SLOTS; j++)
+            if (slots[j].state == SLOT_INFLIGHT && same_topic(&slots[j], s))
+                busy = true;
+        if (busy)
+            continue;
+        s->id = alloc_id();
+        s->tries = 0;
+        if (!transmit(s))
+            return;
+        s->state = SLOT_INFLIGHT;
+        inflight++;
+    }
+}
+
+/* returns false if the message has to be sent with QoS 0 */
+bool qos_publish(const String &topic, const uint8_t *payload, unsigned int len, bool retained)
+{
+    if (!config.qos1 || retained || topic.length() + len > QOS_MSG_MAX)
+        return false;
+    QosSlot msg;
+    msg.topic_len = topic.length();
+    memcpy(msg.buf, topic.c_str(), msg.topic_len);
+    QosSlot *inflight = NULL, *queued = NULL, *free_slot = NULL, *oldest = NULL;
+    for (int i = 0; i < QOS_SLOTS; i++) {
+        QosSlot *s = &slots[i];
+        if (s->state == SLOT_FREE) {
+            if (!free_slot)
+                free_slot = s;
+        } else if (same_topic(s, &msg)) {
+            if (s->state == SLOT_INFLIGHT)
+                inflight = s;
+            else
+                queued = s;
+        } else if (s->state == SLOT_QUEUED && (!oldest || (int32_t)(s->seq - oldest->seq) < 0))
+            oldest = s;
+    }
+    /* an older value still waiting is replaced, it would be outdated anyway */
+    QosSlot *s = queued ? queued : free_slot;
+    if (!s) {
+        /* with QoS 0 it could overtake the message in flight, so another topic loses its waiting value */
+        if (!inflight || !oldest) {
+            qos_stats.downgraded++;
+            return false;
+        }
+        static bool logged = false;
+        if (!logged) {
+            Serial.println("QoS 1 table full, dropping the oldest waiting message of another topic");
+            logged = true;
+        }
+        qos_stats.overflow++;
+        s = oldest;
+    }
+    if (queued)
+        qos_stats.replaced++;
+    s->topic_len = msg.topic_len;
+    memcpy(s->buf, msg.buf, msg.topic_len);
+    memcpy(s->buf + s->topic_len, payload, len);
+    s->len = len;
+    s->seq = next_seq++;
+    s->state = SLOT_QUEUED;
+    send_queued();
+    return true;
+}
+
+/* after (re)connect, the broker has forgotten everything in flight */
+void qos_connected()
+{
+    for (int i = 0; i < QOS_SLOTS; i++)
+        if (slots[i].state == SLOT_INFLIGHT)
+            slots[i].sent = millis() - QOS_RETRY_MS;
+}
+
+void qos_job()
+{
+    if (!mqtt_ok)
+        return;
+    unsigned long now = millis();
+    for (int i = 0; i < QOS_SLOTS; i++) {
+        QosSlot *s = &slots[i];
+        if (s->state != SLOT_INFLIGHT || now - s->sent < QOS_RETRY_MS)
+            continue;
+        if (s->tries >= QOS_MAX_TRIES) {
+            Serial.printf("QoS: giving up on message %u\n", s->id);
+            qos_stats.expired++;
+            s->state = SLOT_FREE;
+            continue;
+        }
+        transmit(s);
+    }
+    send_queued();
+}
+
+void qos_json(JsonObject obj)
+{
+    int inflight = 0, queued = 0;
+    for (int i = 0; i < QOS_SLOTS; i++) {
+        if (slots[i].state == SLOT_INFLIGHT)
+            inflight++;
+        else if (slots[i].state == SLOT_QUEUED)
+            queued++;
+    }
+    obj["window"] = window();
+    obj["in_flight"] = inflight;
+    obj["queued"] = queued;
+    obj["sent"] = qos_stats.sent;
+    obj["acked"] = qos_stats.acked;
+    obj["retransmits"] = qos_stats.retransmits;
+    obj["expired"] = qos_stats.expired;
+    obj["overflow"] = qos_stats.overflow;
+    obj["replaced"] = qos_stats.replaced;
+    obj["downgraded"] = qos_stats.downgraded;
+    ack_latency.to_json(obj["ack_latency"].to<JsonObject>());
+}
@@ -0,0 +1,64 @@
+#ifndef _QOS_H
+#define _QOS_H
+
+#include "Arduino.h"
+#include "globals.h"
+#include <WiFi.h>
+#include <ArduinoJson.h>
+
+/*
+ * QoS 1 publishing of sensor data (config.qos1).
+ * PubSubClient only publishes with QoS 0, so the PUBLISH packets are written
+ * to the connection directly and the PUBACKs are picked out of the incoming
+ * byte stream by MqttLink, which sits between PubSubClient and the WiFiClient.
+ * Up to config.qos_window messages are in flight at the same time, all of
+ * them are kept in a fixed table and sent again with DUP set if they are not
+ * acknowledged within QOS_RETRY_MS, or after a reconnect.
+ * Only one message per topic is in flight. A newer value for that topic
+ * waits in the table (replacing an older waiting one), so the order per topic
+ * is kept. Retained and large messages are sent with QoS 0 as before, and so
+ * is a message for a topic with nothing in flight if the table is full. For
+ * a topic in flight, the oldest waiting message of another topic makes room.
+ */
+#define QOS_SLOTS 16            /* table size, upper limit for the window */
+#define QOS_MSG_MAX 256         /* topic + payload per slot */
+#define QOS_RETRY_MS 5000
+#define QOS_MAX_TRIES 5         /* then the message is dropped */
+
+/* forwards everything to the WiFiClient, watches incoming packets for PUBACK */
+class MqttLink : public Client {
+public:
+    int connect(IPAddress ip, uint16_t port) override { reset(); return _client.connect(ip, port); }
+    int connect(const char *host, uint16_t port) override { reset(); return _client.connect(host, port); }
+    int connect(IPAddress ip, uint16_t port, int32_t timeout) { reset(); return _client.connect(ip, port, timeout); }
+    int connect(const char *host, uint16_t port, int32_t timeout) { reset(); return _client.connect(host, port, timeout); }
+    size_t write(uint8_t c) override { return _client.write(c); }
+    size_t write(const uint8_t *buf, size_t size) override { return _client.write(buf, size); }
+    int available() override { return _client.available(); }
+    int read() override;
+    int read(uint8_t *buf, size_t size) override;
+    int peek() override { return _client.peek(); }
+    void flush() override { _client.flush(); }
+    void stop() override { _client.stop(); }
+    uint8_t connected() override { return _client.connected(); }
+    operator bool() override { return (bool)_client; }
+private:
+    void reset() { _state = 0; }
+    void sniff(uint8_t c);
+    WiFiClient _client;
+    uint8_t _state;     /* position in the packet: header, length, body */
+    uint8_t _type;      /* packet type of the current packet */
+    uint8_t _shift;
+    uint32_t _len;      /* remaining length */
+    uint32_t _pos;
+    uint16_t _id;
+};
+
+extern MqttLink mqtt_link;
+
+bool qos_publish(const String &topic, const uint8_t *payload, unsigned int len, bool retained);
+void qos_connected();
+void qos_job();
+void qos_json(JsonObject obj);
+
+#endif
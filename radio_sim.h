@@ -0,0 +1,100 @@
+#ifndef _RADIO_SIM_H
+#define _RADIO_SIM_H
+
+/*
+ * Simulated radio for testing without sensors, enable with -DSIMULATE_RADIO.
+ * Generates LaCrosse frames for the sensors in sim_sensors[], each with its
+ * own frequency offset. A frame is only "received" if the radio listens on
+ * the sensor's data rate and the signal fits into the receive bandwidth
+ * around the current center frequency, so the auto tuning can be observed.
+ * Only uses Arduino basics, test/test_tuning.cpp runs the tuning against it on the host.
+ */
+
+#include "Arduino.h"
+#include "lacrosse.h"
+
+struct SimSensor {
+    uint8_t id;         /* 0-63 */
+    uint8_t rate_idx;   /* 0 = 9.579 kbps, 1 = 17.241 kbps */
+    int32_t offset_hz;  /* frequency error of the sensor */
+    uint16_t period_ms;
+    int8_t rssi;
+};
+
+/* edit to simulate a different sensor population */
+static const SimSensor sim_sensors[] = {
+    {  5, 1, -12000, 4000, -60 },
+    { 17, 1,   3000, 4100, -75 },
+    { 33, 0,  25000, 4200, -80 },
+    { 42, 1, -41000, 4300, -90 },
+};
+#define SIM_SENSORS (sizeof(sim_sensors) / sizeof(sim_sensors[0]))
+
+class SimRadio {
+public:
+    int16_t beginFSK(float freq, float br, float dev, float rxbw) {
+        _base = _freq = freq;
+        _br = br;
+        _dev = dev;
+        _rxbw = rxbw;
+        return 0;
+    }
+    int16_t setFrequency(float freq) { _freq = freq; return 0; }
+    int16_t setRxBandwidth(float rxbw) { _rxbw = rxbw; return 0; }
+    int16_t setBitRate(float br) { _br = br; return 0; }
+    int16_t setAFC(bool) { return 0; }
+    int16_t setCRC(bool) { return 0; }
+    int16_t setSyncWord(uint8_t *, size_t) { return 0; }
+    int16_t fixedPacketLengthMode(uint8_t) { return 0; }
+    void setPacketReceivedAction(void (*cb)(void)) { _cb = cb; }
+    int16_t standby() { return 0; }
+    int16_t startReceive() { return 0; }
+    float getRSSI() { return _rssi; }
+    float getFrequencyError(bool = false) { return _fei; }
+    int16_t readData(uint8_t *data, size_t len) {
+        memcpy(data, _frame, len < sizeof(_frame) ? len : sizeof(_frame));
+        return 0;
+    }
+
+    /* call from loop() */
+    void poll() {
+        unsigned long now = millis();
+        for (int i = 0; i < SIM_SENSORS; i++) {
+            const SimSensor *s = &sim_sensors[i];
+            if ((long)(now - _next[i]) < 0)
+                continue;
+            _next[i] = now + s->period_ms;
+            if (s->rate_idx != (_br < 10 ? 0 : 1))
+                continue;
+            /* offset relative to the current center frequency */
+            float off_khz = s->offset_hz / 1000.0 - (_freq - _base) * 1000.0;
+            if (fabs(off_khz) + _dev + _br / 2 > _rxbw)
+                continue;
+            make_frame(s, now);
+            _fei = off_khz * 1000.0;
+            _rssi = s->rssi;
+            if (_cb)
+                _cb();
+        }
+    }
+
+private:
+    void make_frame(const SimSensor *s, unsigned long now) {
+        /* slowly varying temperature and humidity */
+        int t = 615 + (int)((now / 60000 + s->id) % 20);   /* (T + 40) * 10 */
+        int h = 40 + (s->id % 30);
+        _frame[0] = 0x90 | ((s->id >> 2) & 0x0f);
+        _frame[1] = ((s->id & 0x03) << 6) | (t / 100);
+        _frame[2] = (((t / 10) % 10) << 4) | (t % 10);
+        _frame[3] = h;
+        _frame[4] = LaCrosse::CalculateCRC(_frame, FRAME_LENGTH - 1);
+    }
+    float _base, _freq, _br, _dev, _rxbw;
+    float _fei = 0;
+    float _rssi = 0;
+    void (*_cb)(void) = NULL;
+    unsigned long _next[SIM_SENSORS] = {};
+    uint8_t _frame[FRAME_LENGTH];
+};
+
+#endif
@@ -0,0 +1,153 @@
+#include "snapshot.h"
+#include "hass.h"
+#include "labels.h"
+#include <LittleFS.h>
+#include "rom/crc.h"
+
+#define SNAP_MAGIC   0x50414e53 /* "SNAP" */
+#define SNAP_VERSION 2
+
+struct SnapEntry {
+    uint32_t age_ms;    /* at the time of the snapshot */
+    uint8_t ID;
+    uint8_t data[FRAME_LENGTH];
+    int8_t rssi;
+    uint8_t hass_cfg;
+    uint32_t label_crc; /* of the label hass_cfg was announced with, 0 == none */
+};
+
+struct Snapshot {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t crc;       /* over count and entry[0..count) */
+    SnapEntry entry[SENSOR_NUM];
+};
+
+/* not cleared on reset, contents are random after power on */
+static RTC_NOINIT_ATTR Snapshot rtc_snap;
+bool snap_restored = false;
+
+#define SNAP_HDR_SIZE (offsetof(Snapshot, entry))
+#define SNAP_SIZE(n) (SNAP_HDR_SIZE + (n) * sizeof(SnapEntry))
+
+static uint32_t snap_crc(const Snapshot *s)
+{
+    uint32_t crc = crc32_le(0, (const uint8_t *)&s->count, sizeof(s->count));
+    return crc32_le(crc, (const uint8_t *)s->entry, s->count * sizeof(SnapEntry));
+}
+
+static uint32_t label_crc(int ID)
+{
+    if (!labels.has(ID))
+        return 0;
+    return crc32_le(0, (const uint8_t *)labels.get(ID), labels.length(ID));
+}
+
+static bool snap_valid(const Snapshot *s)
+{
+    return s->magic == SNAP_MAGIC && s->version == SNAP_VERSION &&
+           s->count <= SENSOR_NUM && s->crc == snap_crc(s);
+}
+
+static void snap_take(Snapshot *s)
+{
+    unsigned long now = millis();
+    uint16_t n = 0;
+    for (int i = 0; i < SENSOR_NUM; i++) {
+        if (fcache[i].timestamp == 0)
+            continue;
+        SnapEntry *e = &s->entry[n++];
+        e->age_ms = now - fcache[i].timestamp;
+        e->ID = i;
+        memcpy(e->data, fcache[i].data, FRAME_LENGTH);
+        e->rssi = fcache[i].rssi;
+        e->hass_cfg = hass_cfg[i];
+        e->label_crc = label_crc(i);
+    }
+    s->magic = SNAP_MAGIC;
+    s->version = SNAP_VERSION;
+    s->count = n;
+    s->crc = snap_crc(s);
+}
+
+void snap_job()
+{
+    static unsigned long last = 0;
+    unsigned long now = millis();
+    if (now - last < SNAP_INTERVAL_MS)
+        return;
+    last = now;
+    snap_take(&rtc_snap);
+}
+
+/* before a planned restart */
+void snap_save()
+{
+    snap_take(&rtc_snap);
+    if (!littlefs_ok)
+        return;
+    File file = LittleFS.open(SNAP_FILE, FILE_WRITE);
+    if (!file) {
+        Serial.println("snapshot: open " SNAP_FILE " failed");
+        return;
+    }
+    size_t len = SNAP_SIZE(rtc_snap.count);
+    if (file.write((const uint8_t *)&rtc_snap, len) != len)
+        Serial.println("snapshot: write failed");
+    file.close();
+}
+
+static bool snap_read_file(Snapshot *s)
+{
+    if (!littlefs_ok || !LittleFS.exists(SNAP_FILE))
+        return false;
+    File file = LittleFS.open(SNAP_FILE);
+    bool ok = false;
+    if (file) {
+        if (file.read((uint8_t *)s, SNAP_HDR_SIZE) == SNAP_HDR_SIZE && s->count <= SENSOR_NUM) {
+            size_t len = s->count * sizeof(SnapEntry);
+            ok = file.read((uint8_t *)s->entry, len) == len && snap_valid(s);
+        }
+        file.close();
+    }
+    /* only good for the restart it was written for */
+    LittleFS.remove(SNAP_FILE);
+    return ok;
+}
+
+/*
+ * Called after the config and labels are loaded, so that the hass_cfg bits
+ * are not cleared again by loading the labels. Prefers the RTC snapshot,
+ * it is more recent than the file.
+ */
+bool snap_restore()
+{
+    Snapshot *s = &rtc_snap;
+    const char *from = "RTC";
+    if (!snap_valid(s)) {
+        s = (Snapshot *)malloc(sizeof(Snapshot));
+        from = SNAP_FILE;
+        if (!s || !snap_read_file(s)) {
+            free(s);
+            return false;
+        }
+    } else if (littlefs_ok && LittleFS.exists(SNAP_FILE))
+        LittleFS.remove(SNAP_FILE);
+    for (int i = 0; i < s->count; i++) {
+        SnapEntry *e = &s->entry[i];
+        /* relative to boot, so the time spent booting is included */
+        fcache[e->ID].timestamp = 0UL - e->age_ms;
+        if (fcache[e->ID].timestamp == 0)
+            fcache[e->ID].timestamp = 1;
+        memcpy(fcache[e->ID].data, e->data, FRAME_LENGTH);
+        fcache[e->ID].rssi = e->rssi;
+        /* announced under another name before the restart: announce again */
+        hass_cfg[e->ID] = e->label_crc == label_crc(e->ID) ? e->hass_cfg : 0;
+    }
+    Serial.printf("snapshot: restored %d sensors from %s\n", s->count, from);
+    snap_restored = s->count > 0;
+    if (s != &rtc_snap)
+        free(s);
+    return snap_restored;
+}
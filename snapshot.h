@@ -0,0 +1,26 @@
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include "Arduino.h"
+#include "globals.h"
+
+/*
+ * Warm restart: the frame cache (also the base of the plausibility filter)
+ * and the Home Assistant "discovery sent" bits survive a reboot.
+ * A snapshot is kept in RTC memory, which survives soft resets and crashes
+ * but not power loss, and is written to LittleFS before planned restarts
+ * (firmware update, format). Both are checked by magic, version and CRC.
+ * Timestamps are stored as age, so the restored entries age correctly. The
+ * discovery bits are only restored if the sensor's label is still the same.
+ */
+#define SNAP_FILE "/cache.bin"
+#define SNAP_INTERVAL_MS (5 * 1000UL)   /* RTC snapshot interval */
+
+/* true after a snapshot was restored, until the first MQTT connect */
+extern bool snap_restored;
+
+void snap_job();
+void snap_save();
+bool snap_restore();
+
+#endif
@@ -0,0 +1,24 @@
+/*
+ * One gateway for test_cluster.cpp: a copy of cluster.cpp with its own
+ * globals, included once per gateway inside its own namespace.
+ * No include guard on purpose.
+ */
+Config config;
+String mqtt_id;
+bool mqtt_ok;
+
+/* renamed, argument dependent lookup would also find the global one */
+bool gw_mqtt_publish(const String &topic, const uint8_t *payload, unsigned int len, bool retained = false)
+{
+    if (!mqtt_ok)
+        return false;
+    broker_publish(topic.c_str(), payload, len, retained);
+    return true;
+}
+
+#define mqtt_publish gw_mqtt_publish
+#include "../cluster.cpp"
+#undef mqtt_publish
+
+Gateway gateway = { &config, &mqtt_id, &mqtt_ok, cluster_heard, cluster_owns, cluster_owned,
+                    cluster_connected, cluster_receive, cluster_job, cluster_json };
@@ -0,0 +1,262 @@
+/*
+ * Host side of the stubs: Serial, the fake clock, the other end of WiFiClient
+ * and the serializers of the ArduinoJson stub. Linked into every test.
+ */
+#include "Arduino.h"
+#include <ArduinoJson.h>
+#include <WiFi.h>
+
+HardwareSerial Serial;
+HostPeer *host_peer;
+
+static bool verbose = getenv("VERBOSE") != NULL;
+static uint64_t now_us = 1000000;
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    if (verbose)
+        fputc(c, stdout);
+    return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t size)
+{
+    if (verbose)
+        fwrite(buf, 1, size, stdout);
+    return size;
+}
+
+unsigned long millis()
+{
+    return now_us / 1000;
+}
+
+unsigned long micros()
+{
+    return now_us;
+}
+
+int64_t esp_timer_get_time()
+{
+    return now_us;
+}
+
+void host_advance_ms(unsigned long ms)
+{
+    now_us += (uint64_t)ms * 1000;
+}
+
+void host_advance_us(uint64_t us)
+{
+    now_us += us;
+}
+
+static int64_t wall_offset_us;   /* wall clock - fake clock */
+
+int host_gettimeofday(struct timeval *tv, void *)
+{
+    int64_t us = now_us + wall_offset_us;
+    tv->tv_sec = us / 1000000;
+    tv->tv_usec = us % 1000000;
+    return 0;
+}
+
+void host_set_wallclock(time_t sec)
+{
+    wall_offset_us = (int64_t)sec * 1000000 - now_us;
+}
+
+/* like the library: up to 9 decimals for double, 7 significant digits for float, no trailing zeros */
+static void json_number(std::string &out, const JsonNode *n)
+{
+    char buf[40];
+    if (n->f32)
+        snprintf(buf, sizeof(buf), "%.7g", n->f);
+    else if (fabs(n->f) < 1e9)
+        snprintf(buf, sizeof(buf), "%.9f", n->f);
+    else
+        snprintf(buf, sizeof(buf), "%.9g", n->f);
+    if (strchr(buf, '.') && !strchr(buf, 'e')) {
+        char *e = buf + strlen(buf) - 1;
+        while (*e == '0')
+            *e-- = 0;
+        if (*e == '.')
+            *e = 0;
+    }
+    out += buf;
+}
+
+static void json_string(std::string &out, const std::string &s)
+{
+    out += '"';
+    for (unsigned char c : s) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                } else
+                    out += c;
+        }
+    }
+    out += '"';
+}
+
+static void json_write(std::string &out, const JsonNode *n)
+{
+    switch (n->type) {
+        case JsonNode::T_NULL: out += "null"; break;
+        case JsonNode::T_BOOL: out += n->b ? "true" : "false"; break;
+        case JsonNode::T_INT: out += std::to_string(n->i); break;
+        case JsonNode::T_UINT: out += std::to_string(n->u); break;
+        case JsonNode::T_FLOAT: json_number(out, n); break;
+        case JsonNode::T_STRING: json_string(out, n->s); break;
+        case JsonNode::T_RAW: out += n->s; break;
+        case JsonNode::T_OBJECT: {
+            out += '{';
+            bool first = true;
+            for (auto &m : n->members) {
+                if (m.second->type == JsonNode::T_NULL)
+                    continue;
+                if (!first)
+                    out += ',';
+                first = false;
+                json_string(out, m.first);
+                out += ':';
+                json_write(out, m.second.get());
+            }
+            out += '}';
+            break;
+        }
+        case JsonNode::T_ARRAY:
+            out += '[';
+            for (size_t i = 0; i < n->items.size(); i++) {
+                if (i)
+                    out += ',';
+                json_write(out, n->items[i].get());
+            }
+            out += ']';
+            break;
+    }
+}
+
+std::string json_text(const JsonNode *n)
+{
+    std::string out;
+    if (n)
+        json_write(out, n);
+    else
+        out = "null";
+    return out;
+}
+
+static void mp_be(std::string &out, uint8_t tag, uint64_t v, int bytes)
+{
+    out += (char)tag;
+    for (int i = bytes - 1; i >= 0; i--)
+        out += (char)(v >> (8 * i));
+}
+
+static void mp_uint(std::string &out, uint64_t v)
+{
+    if (v < 0x80)
+        out += (char)v;
+    else if (v <= 0xff)
+        mp_be(out, 0xcc, v, 1);
+    else if (v <= 0xffff)
+        mp_be(out, 0xcd, v, 2);
+    else if (v <= 0xffffffffULL)
+        mp_be(out, 0xce, v, 4);
+    else
+        mp_be(out, 0xcf, v, 8);
+}
+
+static void mp_int(std::string &out, int64_t v)
+{
+    if (v >= 0)
+        mp_uint(out, v);
+    else if (v >= -32)
+        out += (char)(0xe0 | (v & 0x1f));
+    else if (v >= INT8_MIN)
+        mp_be(out, 0xd0, (uint8_t)v, 1);
+    else if (v >= INT16_MIN)
+        mp_be(out, 0xd1, (uint16_t)v, 2);
+    else if (v >= INT32_MIN)
+        mp_be(out, 0xd2, (uint32_t)v, 4);
+    else
+        mp_be(out, 0xd3, (uint64_t)v, 8);
+}
+
+static void mp_str(std::string &out, const std::string &s)
+{
+    if (s.size() < 32)
+        out += (char)(0xa0 | s.size());
+    else if (s.size() <= 0xff)
+        mp_be(out, 0xd9, s.size(), 1);
+    else
+        mp_be(out, 0xda, s.size(), 2);
+    out += s;
+}
+
+static void mp_write(std::string &out, const JsonNode *n)
+{
+    switch (n->type) {
+        case JsonNode::T_NULL: out += (char)0xc0; break;
+        case JsonNode::T_BOOL: out += (char)(n->b ? 0xc3 : 0xc2); break;
+        case JsonNode::T_INT: mp_int(out, n->i); break;
+        case JsonNode::T_UINT: mp_uint(out, n->u); break;
+        case JsonNode::T_FLOAT: {
+            float f = n->f;
+            if ((double)f == n->f || n->f32) {
+                uint32_t v;
+                memcpy(&v, &f, 4);
+                mp_be(out, 0xca, v, 4);
+            } else {
+                uint64_t v;
+                memcpy(&v, &n->f, 8);
+                mp_be(out, 0xcb, v, 8);
+            }
+            break;
+        }
+        case JsonNode::T_STRING: mp_str(out, n->s); break;
+        case JsonNode::T_RAW: out += n->s; break;
+        case JsonNode::T_OBJECT: {
+            size_t cnt = n->size();
+            if (cnt < 16)
+                out += (char)(0x80 | cnt);
+            else
+                mp_be(out, 0xde, cnt, 2);
+            for (auto &m : n->members) {
+                if (m.second->type == JsonNode::T_NULL)
+                    continue;
+                mp_str(out, m.first);
+                mp_write(out, m.second.get());
+            }
+            break;
+        }
+        case JsonNode::T_ARRAY:
+            if (n->items.size() < 16)
+                out += (char)(0x90 | n->items.size());
+            else
+                mp_be(out, 0xdc, n->items.size(), 2);
+            for (auto &i : n->items)
+                mp_write(out, i.get());
+            break;
+    }
+}
+
+std::string msgpack_bytes(const JsonNode *n)
+{
+    std::string out;
+    if (n)
+        mp_write(out, n);
+    else
+        out += (char)0xc0;
+    return out;
+}
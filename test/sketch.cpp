@@ -0,0 +1,76 @@
+/*
+ * What the modules expect from lacrosse2mqtt.ino: the shared globals, the
+ * state lock and MQTT publishing, which records the messages in published[]
+ * and counts them like the sketch does.
+ */
+#include "test.h"
+
+Config config;
+Cache fcache[SENSOR_NUM];
+bool littlefs_ok;
+bool mqtt_ok = true;
+MqttStats mqtt_stats;
+uint32_t rxq_dropped;
+String mqtt_id = "lacrosse2mqtt_test";
+const String pretty_base = "climate/";
+const String pub_base = "lacrosse/id_";
+
+std::vector<Published> published;
+int test_checks, test_failures;
+bool host_state_busy;
+
+bool lock_state(uint32_t)
+{
+    return !host_state_busy;
+}
+
+void unlock_state()
+{
+}
+
+/* same as in the sketch */
+void mqtt_count(unsigned int topic_len, unsigned int len)
+{
+    unsigned int rem = 2 + topic_len + len;
+    mqtt_stats.publishes++;
+    mqtt_stats.bytes += 1 + (rem < 128 ? 1 : (rem < 16384 ? 2 : 3)) + rem;
+}
+
+bool mqtt_publish(const String &topic, const uint8_t *payload, unsigned int len, bool retained)
+{
+    if (!mqtt_ok)
+        return false;
+    published.push_back({ topic.c_str(), std::string((const char *)payload, len), retained });
+    mqtt_count(topic.length(), len);
+    return true;
+}
+
+bool mqtt_publish(const String &topic, const String &payload, bool retained)
+{
+    return mqtt_publish(topic, (const uint8_t *)payload.c_str(), payload.length(), retained);
+}
+
+bool mqtt_publish(const String &topic, JsonDocument &json, bool msgpack)
+{
+    size_t len = msgpack ? measureMsgPack(json) : measureJson(json);
+    std::vector<char> buf(len + 1);
+    if (msgpack)
+        serializeMsgPack(json, buf.data(), len + 1);
+    else
+        serializeJson(json, buf.data(), len + 1);
+    return mqtt_publish(topic, (const uint8_t *)buf.data(), len);
+}
+
+std::string to_json(JsonDocument &doc)
+{
+    size_t len = measureJson(doc);
+    std::vector<char> buf(len + 1);
+    serializeJson(doc, buf.data(), len + 1);
+    return buf.data();
+}
+
+int test_done(const char *name)
+{
+    printf("%s: %d checks, %d failed\n", name, test_checks, test_failures);
+    return test_failures ? 1 : 0;
+}
@@ -0,0 +1,194 @@
+#ifndef _HOST_ARDUINO_H
+#define _HOST_ARDUINO_H
+
+/*
+ * Just enough of the Arduino core to build the hardware independent modules
+ * on a host. String works like the original, time comes from a fake clock
+ * that the tests advance with host_advance_ms(). Serial output is dropped
+ * unless VERBOSE is set in the environment.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <string>
+#include <type_traits>
+
+typedef uint8_t byte;
+
+#define IRAM_ATTR
+#define RTC_NOINIT_ATTR
+#define RTC_DATA_ATTR
+#define F(x) (x)
+#define HIGH 1
+#define LOW 0
+#define DEC 10
+#define HEX 16
+#define BIN 2
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define portMAX_DELAY 0xffffffff
+#define pdMS_TO_TICKS(ms) (ms)
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+using std::min;
+using std::max;
+
+class String {
+public:
+    String(const char *s = "") : _s(s ? s : "") {}
+    String(const std::string &s) : _s(s) {}
+    explicit String(char c) : _s(1, c) {}
+    String(unsigned char v, unsigned char base = 10) : _s(num(v, base)) {}
+    String(int v, unsigned char base = 10) : _s(num(v, base)) {}
+    String(unsigned int v, unsigned char base = 10) : _s(num(v, base)) {}
+    String(long v, unsigned char base = 10) : _s(num(v, base)) {}
+    String(unsigned long v, unsigned char base = 10) : _s(num(v, base)) {}
+    String(long long v, unsigned char base = 10) : _s(num(v, base)) {}
+    String(unsigned long long v, unsigned char base = 10) : _s(num(v, base)) {}
+    String(float v, unsigned int decimals = 2) : _s(fix(v, decimals)) {}
+    String(double v, unsigned int decimals = 2) : _s(fix(v, decimals)) {}
+
+    unsigned int length() const { return _s.size(); }
+    bool isEmpty() const { return _s.empty(); }
+    const char *c_str() const { return _s.c_str(); }
+    bool reserve(unsigned int n) { _s.reserve(n); return true; }
+    char operator[](unsigned int i) const { return i < _s.size() ? _s[i] : 0; }
+    char &operator[](unsigned int i) { return _s[i]; }
+    char charAt(unsigned int i) const { return (*this)[i]; }
+
+    String &operator+=(const String &o) { _s += o._s; return *this; }
+    String &operator+=(const char *s) { _s += s; return *this; }
+    String &operator+=(char c) { _s += c; return *this; }
+    template <typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+    String &operator+=(T v) { _s += String(v)._s; return *this; }
+    bool concat(const String &o) { _s += o._s; return true; }
+    bool concat(const char *s, unsigned int n) { _s.append(s, n); return true; }
+
+    bool operator==(const String &o) const { return _s == o._s; }
+    bool operator==(const char *s) const { return _s == s; }
+    bool operator!=(const String &o) const { return _s != o._s; }
+    bool operator!=(const char *s) const { return _s != s; }
+    bool operator<(const String &o) const { return _s < o._s; }
+    bool equals(const String &o) const { return _s == o._s; }
+    bool startsWith(const String &p) const { return _s.compare(0, p._s.size(), p._s) == 0; }
+    bool endsWith(const String &p) const {
+        return _s.size() >= p._s.size() && _s.compare(_s.size() - p._s.size(), p._s.size(), p._s) == 0;
+    }
+    int indexOf(char c, unsigned int from = 0) const { return pos(_s.find(c, from)); }
+    int indexOf(const String &s, unsigned int from = 0) const { return pos(_s.find(s._s, from)); }
+    String substring(unsigned int from) const { return from < _s.size() ? String(_s.substr(from)) : String(); }
+    String substring(unsigned int from, unsigned int to) const {
+        if (from > to)
+            std::swap(from, to);
+        return from < _s.size() ? String(_s.substr(from, to - from)) : String();
+    }
+    long toInt() const { return strtol(_s.c_str(), NULL, 10); }
+    float toFloat() const { return strtof(_s.c_str(), NULL); }
+    void toLowerCase() { for (auto &c : _s) c = tolower((unsigned char)c); }
+    void trim() {
+        size_t a = _s.find_first_not_of(" \t\r\n");
+        size_t b = _s.find_last_not_of(" \t\r\n");
+        _s = (a == std::string::npos) ? "" : _s.substr(a, b - a + 1);
+    }
+    void clear() { _s.clear(); }
+
+    friend String operator+(const String &a, const String &b) { return String(a._s + b._s); }
+    friend String operator+(const String &a, const char *b) { return String(a._s + b); }
+    friend String operator+(const char *a, const String &b) { return String(a + b._s); }
+    friend String operator+(const String &a, char c) { return String(a._s + c); }
+    template <typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+    friend String operator+(const String &a, T v) { return a + String(v); }
+    friend bool operator==(const char *a, const String &b) { return b == a; }
+
+private:
+    static int pos(size_t p) { return p == std::string::npos ? -1 : (int)p; }
+    template <typename T> static std::string num(T v, unsigned char base) {
+        if (base == 10)
+            return std::to_string(v);
+        std::string s;
+        unsigned long long u = (unsigned long long)v;
+        if (std::is_signed<T>::value && v < 0)
+            u = (unsigned long long)(typename std::make_unsigned<T>::type)v;
+        do {
+            s.insert(s.begin(), "0123456789ABCDEF"[u % base]);
+            u /= base;
+        } while (u);
+        return s;
+    }
+    static std::string fix(double v, unsigned int decimals) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+        return buf;
+    }
+    std::string _s;
+};
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buf, size_t size) {
+        size_t n = 0;
+        while (size--)
+            n += write(*buf++);
+        return n;
+    }
+    size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+    size_t print(const String &s) { return write((const uint8_t *)s.c_str(), s.length()); }
+    size_t print(const char *s) { return write(s); }
+    template <typename T> size_t print(T v) { return print(String(v)); }
+    template <typename T> size_t print(T v, int fmt) { return print(String(v, fmt)); }
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(T v) { return print(v) + println(); }
+    template <typename T> size_t println(T v, int fmt) { return print(v, fmt) + println(); }
+    size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+        char buf[512];
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+        va_end(ap);
+        return write((const uint8_t *)buf, std::min((size_t)n, sizeof(buf) - 1));
+    }
+    virtual void flush() {}
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+class HardwareSerial : public Stream {
+public:
+    void begin(unsigned long) {}
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buf, size_t size) override;
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+};
+extern HardwareSerial Serial;
+
+/* fake clock, starts at one second after boot */
+unsigned long millis();
+unsigned long micros();
+int64_t esp_timer_get_time();
+void host_advance_ms(unsigned long ms);
+void host_advance_us(uint64_t us);
+/* the wall clock runs with the fake clock, it is not set (1970) until host_set_wallclock() */
+int host_gettimeofday(struct timeval *tv, void *tz);
+#define gettimeofday host_gettimeofday
+void host_set_wallclock(time_t sec);
+
+static inline void pinMode(int, int) {}
+static inline void digitalWrite(int, int) {}
+
+#endif
@@ -0,0 +1,358 @@
+#ifndef _HOST_ARDUINOJSON_H
+#define _HOST_ARDUINOJSON_H
+
+/*
+ * The part of the ArduinoJson 7 API used by the tested modules, so the host
+ * tests do not depend on the library being installed. Documents are trees of
+ * JsonNode, serializeJson() and serializeMsgPack() produce the same encoding
+ * as the library for the types used here. Reading a key that is never
+ * written leaves a null member behind, null members are not serialized.
+ * A document with an allocator gets one block per value and per string from
+ * it, so the allocator sees the same kind of traffic as with the library.
+ */
+#include "Arduino.h"
+#include <memory>
+#include <vector>
+
+namespace ArduinoJson {
+class Allocator {
+public:
+    virtual void *allocate(size_t size) = 0;
+    virtual void deallocate(void *ptr) = 0;
+    virtual void *reallocate(void *ptr, size_t new_size) = 0;
+protected:
+    ~Allocator() {}
+};
+}
+
+struct JsonResources {
+    ArduinoJson::Allocator *alloc;
+    std::vector<void *> blocks;
+    void use(size_t size) {
+        if (alloc)
+            blocks.push_back(alloc->allocate(size));
+    }
+    void release() {
+        for (void *p : blocks)
+            alloc->deallocate(p);
+        blocks.clear();
+    }
+};
+
+struct JsonNode {
+    enum Type { T_NULL, T_BOOL, T_INT, T_UINT, T_FLOAT, T_STRING, T_RAW, T_OBJECT, T_ARRAY };
+    Type type = T_NULL;
+    bool b = false;
+    bool f32 = false;       /* assigned from a float, printed with float precision */
+    int64_t i = 0;
+    uint64_t u = 0;
+    double f = 0;
+    std::string s;
+    std::vector<std::pair<std::string, std::unique_ptr<JsonNode>>> members;
+    std::vector<std::unique_ptr<JsonNode>> items;
+    JsonResources *res = nullptr;
+
+    void reset(Type t) {
+        type = t;
+        members.clear();
+        items.clear();
+    }
+    JsonNode *child(JsonResources *r) {
+        JsonNode *n = new JsonNode;
+        n->res = r;
+        if (r)
+            r->use(16);
+        return n;
+    }
+    JsonNode *member(const std::string &key) {
+        if (type == T_NULL)
+            reset(T_OBJECT);
+        if (type != T_OBJECT)
+            return nullptr;
+        for (auto &m : members)
+            if (m.first == key)
+                return m.second.get();
+        if (res)
+            res->use(key.size() + 1);
+        members.emplace_back(key, std::unique_ptr<JsonNode>(child(res)));
+        return members.back().second.get();
+    }
+    JsonNode *item(size_t idx) {
+        if (type == T_NULL)
+            reset(T_ARRAY);
+        if (type != T_ARRAY)
+            return nullptr;
+        while (items.size() <= idx)
+            items.emplace_back(child(res));
+        return items[idx].get();
+    }
+    size_t size() const {
+        if (type == T_ARRAY)
+            return items.size();
+        size_t n = 0;
+        for (auto &m : members)
+            n += m.second->type != T_NULL;
+        return n;
+    }
+};
+
+struct SerializedValue {
+    std::string s;
+};
+static inline SerializedValue serialized(const String &s) { return SerializedValue{ s.c_str() }; }
+static inline SerializedValue serialized(const char *s) { return SerializedValue{ s }; }
+
+class JsonObject;
+class JsonArray;
+
+class JsonVariant {
+public:
+    JsonVariant(JsonNode *n = nullptr) : _n(n) {}
+
+    JsonVariant operator[](const char *key) const { return JsonVariant(_n ? _n->member(key) : nullptr); }
+    JsonVariant operator[](const String &key) const { return (*this)[key.c_str()]; }
+    JsonVariant operator[](int idx) const { return JsonVariant(_n ? _n->item(idx) : nullptr); }
+
+    JsonVariant &operator=(const JsonVariant &) = default;
+    template <typename T> JsonVariant &operator=(T v) {
+        if (_n)
+            set(v);
+        return *this;
+    }
+
+    template <typename T> T to() const;
+    template <typename T> T as() const;
+    template <typename T> bool is() const;
+    template <typename T> T add() const;
+    template <typename T> bool add(T v) const {
+        JsonVariant item(_n ? _n->item(_n->type == JsonNode::T_ARRAY ? _n->items.size() : 0) : nullptr);
+        item = v;
+        return _n != nullptr;
+    }
+    size_t size() const { return _n ? _n->size() : 0; }
+    bool isNull() const { return !_n || _n->type == JsonNode::T_NULL; }
+    void remove(const char *key) const {
+        if (!_n)
+            return;
+        for (auto it = _n->members.begin(); it != _n->members.end(); ++it)
+            if (it->first == key) {
+                _n->members.erase(it);
+                return;
+            }
+    }
+    JsonNode *node() const { return _n; }
+
+protected:
+    void set(bool v) { _n->reset(JsonNode::T_BOOL); _n->b = v; }
+    void set(float v) { set((double)v); _n->f32 = true; }
+    void set(double v) { _n->reset(JsonNode::T_FLOAT); _n->f = v; _n->f32 = false; }
+    void set(const char *v) {
+        _n->reset(v ? JsonNode::T_STRING : JsonNode::T_NULL);
+        _n->s = v ? v : "";
+        if (_n->res)
+            _n->res->use(_n->s.size() + 1);
+    }
+    void set(char *v) { set((const char *)v); }
+    void set(const String &v) { set(v.c_str()); }
+    void set(const SerializedValue &v) {
+        _n->reset(JsonNode::T_RAW);
+        _n->s = v.s;
+        if (_n->res)
+            _n->res->use(_n->s.size() + 1);
+    }
+    template <typename T> typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type set(T v) {
+        _n->reset(JsonNode::T_INT);
+        _n->i = v;
+    }
+    template <typename T> typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type set(T v) {
+        _n->reset(JsonNode::T_UINT);
+        _n->u = v;
+    }
+    JsonNode *_n;
+};
+
+class JsonString {
+public:
+    JsonString(const char *s = nullptr) : _s(s) {}
+    const char *c_str() const { return _s; }
+private:
+    const char *_s;
+};
+
+class JsonPair {
+public:
+    JsonPair(std::pair<std::string, std::unique_ptr<JsonNode>> *m = nullptr) : _m(m) {}
+    JsonString key() const { return JsonString(_m->first.c_str()); }
+    JsonVariant value() const { return JsonVariant(_m->second.get()); }
+private:
+    std::pair<std::string, std::unique_ptr<JsonNode>> *_m;
+};
+
+/* skips the null members left behind by reading, like the serializer */
+class JsonObjectIterator {
+public:
+    JsonObjectIterator(JsonNode *n = nullptr, size_t i = 0) : _n(n), _i(i) { skip(); }
+    JsonPair *operator->() {
+        _pair = JsonPair(&_n->members[_i]);
+        return &_pair;
+    }
+    JsonObjectIterator &operator++() {
+        _i++;
+        skip();
+        return *this;
+    }
+    bool operator==(const JsonObjectIterator &o) const { return _n == o._n && _i == o._i; }
+    bool operator!=(const JsonObjectIterator &o) const { return !(*this == o); }
+private:
+    void skip() {
+        while (_n && _i < _n->members.size() && _n->members[_i].second->type == JsonNode::T_NULL)
+            _i++;
+    }
+    JsonNode *_n;
+    size_t _i;
+    JsonPair _pair;
+};
+
+class JsonObject : public JsonVariant {
+public:
+    typedef JsonObjectIterator iterator;
+    JsonObject(JsonNode *n = nullptr) : JsonVariant(n) {}
+    iterator begin() const { return iterator(_n); }
+    iterator end() const { return iterator(_n, _n ? _n->members.size() : 0); }
+};
+
+class JsonArray : public JsonVariant {
+public:
+    JsonArray(JsonNode *n = nullptr) : JsonVariant(n) {}
+};
+
+template <> inline JsonObject JsonVariant::to<JsonObject>() const {
+    if (!_n)
+        return JsonObject();
+    _n->reset(JsonNode::T_OBJECT);
+    return JsonObject(_n);
+}
+template <> inline JsonArray JsonVariant::to<JsonArray>() const {
+    if (!_n)
+        return JsonArray();
+    _n->reset(JsonNode::T_ARRAY);
+    return JsonArray(_n);
+}
+template <> inline JsonObject JsonVariant::add<JsonObject>() const {
+    if (!_n)
+        return JsonObject();
+    return JsonVariant(_n->item(_n->type == JsonNode::T_ARRAY ? _n->items.size() : 0)).to<JsonObject>();
+}
+
+template <> inline JsonObject JsonVariant::as<JsonObject>() const {
+    return JsonObject(_n && _n->type == JsonNode::T_OBJECT ? _n : nullptr);
+}
+template <> inline JsonArray JsonVariant::as<JsonArray>() const {
+    return JsonArray(_n && _n->type == JsonNode::T_ARRAY ? _n : nullptr);
+}
+template <> inline const char *JsonVariant::as<const char *>() const {
+    return _n && (_n->type == JsonNode::T_STRING || _n->type == JsonNode::T_RAW) ? _n->s.c_str() : nullptr;
+}
+template <> inline String JsonVariant::as<String>() const {
+    const char *s = as<const char *>();
+    return String(s ? s : "");
+}
+template <> inline double JsonVariant::as<double>() const {
+    if (!_n)
+        return 0;
+    switch (_n->type) {
+        case JsonNode::T_BOOL: return _n->b;
+        case JsonNode::T_INT: return _n->i;
+        case JsonNode::T_UINT: return _n->u;
+        case JsonNode::T_FLOAT: return _n->f;
+        default: return 0;
+    }
+}
+template <> inline float JsonVariant::as<float>() const { return as<double>(); }
+template <> inline long JsonVariant::as<long>() const { return lround(as<double>()); }
+template <> inline int JsonVariant::as<int>() const { return lround(as<double>()); }
+template <> inline unsigned long JsonVariant::as<unsigned long>() const { return lround(as<double>()); }
+template <> inline bool JsonVariant::as<bool>() const { return as<double>() != 0; }
+
+template <> inline bool JsonVariant::is<JsonObject>() const { return _n && _n->type == JsonNode::T_OBJECT; }
+template <> inline bool JsonVariant::is<JsonArray>() const { return _n && _n->type == JsonNode::T_ARRAY; }
+template <> inline bool JsonVariant::is<const char *>() const { return _n && _n->type == JsonNode::T_STRING; }
+template <> inline bool JsonVariant::is<bool>() const { return _n && _n->type == JsonNode::T_BOOL; }
+template <> inline bool JsonVariant::is<int>() const {
+    return _n && (_n->type == JsonNode::T_INT || _n->type == JsonNode::T_UINT);
+}
+template <> inline bool JsonVariant::is<float>() const {
+    return _n && (_n->type == JsonNode::T_FLOAT || _n->type == JsonNode::T_INT || _n->type == JsonNode::T_UINT);
+}
+
+class JsonDocument {
+public:
+    JsonDocument(ArduinoJson::Allocator *alloc = nullptr) { _res.alloc = alloc; _root.res = &_res; }
+    ~JsonDocument() { clear(); }
+    JsonDocument(const JsonDocument &) = delete;
+    JsonDocument &operator=(const JsonDocument &) = delete;
+
+    JsonVariant operator[](const char *key) { return root()[key]; }
+    JsonVariant operator[](const String &key) { return root()[key]; }
+    JsonVariant operator[](int idx) { return root()[idx]; }
+    template <typename T> T to() {
+        clear();
+        return root().to<T>();
+    }
+    template <typename T> T as() { return root().as<T>(); }
+    template <typename T> bool is() { return root().is<T>(); }
+    template <typename T> T add() { return root().add<T>(); }
+    template <typename T> bool add(T v) { return root().add(v); }
+    void remove(const char *key) { root().remove(key); }
+    size_t size() const { return _root.size(); }
+    bool isNull() const { return _root.type == JsonNode::T_NULL; }
+    void clear() {
+        _root.reset(JsonNode::T_NULL);
+        _res.release();
+    }
+    operator JsonVariant() { return root(); }
+    operator JsonObject() { return as<JsonObject>(); }
+    JsonNode *node() { return &_root; }
+
+private:
+    JsonVariant root() { return JsonVariant(&_root); }
+    JsonResources _res;
+    JsonNode _root;
+};
+
+std::string json_text(const JsonNode *n);
+std::string msgpack_bytes(const JsonNode *n);
+
+static inline const JsonNode *json_node(JsonDocument &doc) { return doc.node(); }
+static inline const JsonNode *json_node(const JsonVariant &v) { return v.node(); }
+
+static inline size_t json_copy(const std::string &s, void *buf, size_t size, bool nul)
+{
+    size_t n = std::min(s.size(), nul ? size - 1 : size);
+    memcpy(buf, s.data(), n);
+    if (nul)
+        ((char *)buf)[n] = 0;
+    return n;
+}
+
+template <typename T> size_t measureJson(T &src) { return json_text(json_node(src)).size(); }
+template <typename T> size_t serializeJson(T &src, char *buf, size_t size) {
+    return json_copy(json_text(json_node(src)), buf, size, true);
+}
+template <typename T> size_t serializeJson(T &src, String &out) {
+    out = String(json_text(json_node(src)));
+    return out.length();
+}
+template <typename T> size_t serializeJson(T &src, Print &out) {
+    std::string s = json_text(json_node(src));
+    return out.write((const uint8_t *)s.data(), s.size());
+}
+template <typename T> size_t measureMsgPack(T &src) { return msgpack_bytes(json_node(src)).size(); }
+template <typename T> size_t serializeMsgPack(T &src, char *buf, size_t size) {
+    return json_copy(msgpack_bytes(json_node(src)), buf, size, false);
+}
+template <typename T> size_t serializeMsgPack(T &src, uint8_t *buf, size_t size) {
+    return json_copy(msgpack_bytes(json_node(src)), buf, size, false);
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef _HOST_ESPASYNCWEBSERVER_H
+#define _HOST_ESPASYNCWEBSERVER_H
+
+/*
+ * Requests and responses of ESPAsyncWebServer, without the server. The test
+ * plays the server: it calls the handler, pulls the chunks of the response
+ * with fill() and deletes the request when the client is gone, which calls
+ * the disconnect handler and then deletes the response, like the library.
+ */
+#include "Arduino.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+class AsyncWebServerRequest;
+typedef std::function<void(AsyncWebServerRequest *)> ArRequestHandlerFunction;
+typedef std::function<void()> ArDisconnectHandler;
+typedef std::function<size_t(uint8_t *, size_t, size_t)> AwsResponseFiller;
+#define RESPONSE_TRY_AGAIN 0xFFFFFFFF
+
+class AsyncWebServerResponse {
+public:
+    AsyncWebServerResponse(int c, const char *t) : code(c), type(t) {}
+    void addHeader(const char *name, const char *value) { headers.push_back({ name, value }); }
+    void setCode(int c) { code = c; }
+    /* next chunk of at most len bytes, RESPONSE_TRY_AGAIN or 0 at the end */
+    size_t fill(uint8_t *buf, size_t len) {
+        if (!filler) {
+            size_t n = std::min(len, body.size() - sent);
+            memcpy(buf, body.data() + sent, n);
+            sent += n;
+            return n;
+        }
+        size_t n = filler(buf, len, sent);
+        if (n != RESPONSE_TRY_AGAIN)
+            sent += n;
+        return n;
+    }
+    int code;
+    std::string type, body;
+    std::vector<std::pair<std::string, std::string>> headers;
+    AwsResponseFiller filler;
+    size_t sent = 0;
+};
+
+class AsyncWebServerRequest {
+public:
+    ~AsyncWebServerRequest() {
+        if (_disconnect)
+            _disconnect();
+        delete response;
+    }
+    AsyncWebServerResponse *beginResponse(int code, const char *type, const String &body) {
+        AsyncWebServerResponse *r = new AsyncWebServerResponse(code, type);
+        r->body = body.c_str();
+        return r;
+    }
+    AsyncWebServerResponse *beginChunkedResponse(const char *type, AwsResponseFiller filler) {
+        AsyncWebServerResponse *r = new AsyncWebServerResponse(200, type);
+        r->filler = filler;
+        return r;
+    }
+    void send(AsyncWebServerResponse *r) {
+        delete response;
+        response = r;
+    }
+    void send(int code, const char *type = "", const String &body = String()) { send(beginResponse(code, type, body)); }
+    void onDisconnect(ArDisconnectHandler fn) { _disconnect = fn; }
+    AsyncWebServerResponse *response = nullptr;
+private:
+    ArDisconnectHandler _disconnect;
+};
+
+#endif
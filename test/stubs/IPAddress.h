@@ -0,0 +1,18 @@
+#ifndef _HOST_IPADDRESS_H
+#define _HOST_IPADDRESS_H
+
+#include "Arduino.h"
+
+class IPAddress {
+public:
+    IPAddress(uint32_t addr = 0) : _addr(addr) {}
+    String toString() const {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%u.%u.%u.%u", _addr & 0xff, (_addr >> 8) & 0xff, (_addr >> 16) & 0xff, _addr >> 24);
+        return buf;
+    }
+private:
+    uint32_t _addr;
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef _HOST_LITTLEFS_H
+#define _HOST_LITTLEFS_H
+
+/* a file system in memory, files are strings by path; just what the tested modules use */
+#include "Arduino.h"
+#include <map>
+#include <string>
+
+class File {
+public:
+    File() : _data(nullptr), _pos(0) {}
+    File(std::string *data) : _data(data), _pos(0) {}
+    size_t write(const uint8_t *buf, size_t len) {
+        _data->append((const char *)buf, len);
+        return len;
+    }
+    size_t read(uint8_t *buf, size_t len) {
+        size_t n = std::min(len, _data->size() - _pos);
+        memcpy(buf, _data->data() + _pos, n);
+        _pos += n;
+        return n;
+    }
+    void close() { _data = nullptr; }
+    operator bool() const { return _data != nullptr; }
+private:
+    std::string *_data;
+    size_t _pos;
+};
+
+class LittleFSClass {
+public:
+    File open(const char *path, const char *mode = FILE_READ) {
+        if (strcmp(mode, FILE_WRITE) == 0)
+            files[path].clear();
+        else if (!exists(path))
+            return File();
+        return File(&files[path]);
+    }
+    bool exists(const char *path) const { return files.count(path) > 0; }
+    bool remove(const char *path) { return files.erase(path) > 0; }
+    std::map<std::string, std::string> files;
+};
+
+inline LittleFSClass LittleFS;
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef _HOST_UPDATE_H
+#define _HOST_UPDATE_H
+
+/* collects the image in memory and checks the MD5 in end(), like the real one */
+#include "Arduino.h"
+#include <string>
+
+#define UPDATE_SIZE_UNKNOWN 0xFFFFFFFF
+
+class UpdateClass {
+public:
+    bool begin(size_t size);
+    size_t write(uint8_t *data, size_t len);
+    bool setMD5(const char *md5);
+    bool end(bool evenIfRemaining = false);
+    void abort();
+    bool isRunning() const { return _running; }
+    const char *errorString() const { return _error; }
+
+    std::string image;      /* bytes written so far */
+    bool done = false;      /* end() succeeded, the new image would boot */
+    size_t fail_at = 0;     /* write() fails once the image has this size, 0 == never */
+private:
+    bool _running = false;
+    std::string _md5;
+    const char *_error = "No Error";
+};
+
+extern UpdateClass Update;
+
+std::string md5_hex(const std::string &data);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef _HOST_WIFI_H
+#define _HOST_WIFI_H
+
+/* WiFiClient talks to whatever the test puts into host_peer, e.g. a broker stand-in */
+#include "Arduino.h"
+#include "Client.h"
+#include <deque>
+
+class HostPeer {
+public:
+    virtual ~HostPeer() {}
+    /* bytes written by the client */
+    virtual void received(const uint8_t *buf, size_t len) = 0;
+    /* bytes for the client to read */
+    std::deque<uint8_t> rx;
+    bool up = true;
+};
+extern HostPeer *host_peer;
+
+class WiFiClient : public Client {
+public:
+    int connect(IPAddress, uint16_t) override { return host_peer && host_peer->up; }
+    int connect(const char *, uint16_t) override { return host_peer && host_peer->up; }
+    int connect(IPAddress ip, uint16_t port, int32_t) { return connect(ip, port); }
+    int connect(const char *host, uint16_t port, int32_t) { return connect(host, port); }
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t size) override {
+        if (!connected())
+            return 0;
+        host_peer->received(buf, size);
+        return size;
+    }
+    int available() override { return connected() ? host_peer->rx.size() : 0; }
+    int read() override {
+        if (!available())
+            return -1;
+        uint8_t c = host_peer->rx.front();
+        host_peer->rx.pop_front();
+        return c;
+    }
+    int read(uint8_t *buf, size_t size) override {
+        size_t n = 0;
+        while (n < size && available())
+            buf[n++] = read();
+        return n ? (int)n : -1;
+    }
+    int peek() override { return available() ? host_peer->rx.front() : -1; }
+    void flush() override {}
+    void stop() override {}
+    uint8_t connected() override { return host_peer && host_peer->up; }
+    operator bool() override { return connected(); }
+};
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef _HOST_ROM_CRC_H
+#define _HOST_ROM_CRC_H
+
+/* CRC32 of the ESP32 ROM, same result as zlib's */
+#include <stdint.h>
+#include <zlib.h>
+
+static inline uint32_t crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    return crc32(crc, buf, len);
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef _HOST_ROM_MINIZ_H
+#define _HOST_ROM_MINIZ_H
+
+/*
+ * The tinfl interface of the inflater in the ESP32 ROM, implemented with zlib.
+ * Same calling convention: the output goes to a wrapping window of
+ * TINFL_LZ_DICT_SIZE bytes, the status tells whether more input is needed
+ * or the output window is full.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <zlib.h>
+
+typedef uint8_t mz_uint8;
+typedef uint32_t mz_uint32;
+
+enum {
+    TINFL_FLAG_PARSE_ZLIB_HEADER = 1,
+    TINFL_FLAG_HAS_MORE_INPUT = 2,
+    TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF = 4,
+    TINFL_FLAG_COMPUTE_ADLER32 = 8
+};
+
+typedef enum {
+    TINFL_STATUS_FAILED_CANNOT_MAKE_PROGRESS = -4,
+    TINFL_STATUS_BAD_PARAM = -3,
+    TINFL_STATUS_ADLER32_MISMATCH = -2,
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT = 2
+} tinfl_status;
+
+#define TINFL_LZ_DICT_SIZE 32768
+
+typedef struct {
+    z_stream z;
+    int started;
+} tinfl_decompressor;
+
+#define tinfl_init(r) do { (r)->started = 0; } while (0)
+
+static inline tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *in, size_t *in_size,
+                                            mz_uint8 *out_start, mz_uint8 *out_next, size_t *out_size,
+                                            const mz_uint32 flags)
+{
+    (void)out_start;
+    if (!r->started) {
+        memset(&r->z, 0, sizeof(r->z));
+        if (inflateInit2(&r->z, (flags & TINFL_FLAG_PARSE_ZLIB_HEADER) ? 15 : -15) != Z_OK)
+            return TINFL_STATUS_FAILED;
+        r->started = 1;
+    }
+    r->z.next_in = (Bytef *)in;
+    r->z.avail_in = *in_size;
+    r->z.next_out = out_next;
+    r->z.avail_out = *out_size;
+    int ret = inflate(&r->z, Z_NO_FLUSH);
+    *in_size -= r->z.avail_in;
+    *out_size -= r->z.avail_out;
+    if (ret == Z_STREAM_END || (ret != Z_OK && ret != Z_BUF_ERROR)) {
+        inflateEnd(&r->z);
+        r->started = 0;
+        if (ret == Z_STREAM_END)
+            return TINFL_STATUS_DONE;
+        return (r->z.msg && strcmp(r->z.msg, "incorrect data check") == 0) ? TINFL_STATUS_ADLER32_MISMATCH
+                                                                              : TINFL_STATUS_FAILED;
+    }
+    if (r->z.avail_out == 0)
+        return TINFL_STATUS_HAS_MORE_OUTPUT;
+    return (flags & TINFL_FLAG_HAS_MORE_INPUT) ? TINFL_STATUS_NEEDS_MORE_INPUT
+                                               : TINFL_STATUS_FAILED_CANNOT_MAKE_PROGRESS;
+}
+
+#endif
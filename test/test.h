@@ -0,0 +1,58 @@
+#ifndef _TEST_H
+#define _TEST_H
+
+#include "Arduino.h"
+#include "globals.h"
+#include <string>
+#include <vector>
+
+/*
+ * Minimal test helpers. CHECK() reports and counts failures but carries on,
+ * test_done() prints the summary and gives the exit code for main().
+ */
+extern int test_checks, test_failures;
+
+#define CHECK(cond) do { \
+        test_checks++; \
+        if (!(cond)) { \
+            test_failures++; \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) do { \
+        test_checks++; \
+        long long _a = (a), _b = (b); \
+        if (_a != _b) { \
+            test_failures++; \
+            printf("%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, _a, _b); \
+        } \
+    } while (0)
+
+#define CHECK_STR(a, b) do { \
+        test_checks++; \
+        std::string _a = (a), _b = (b); \
+        if (_a != _b) { \
+            test_failures++; \
+            printf("%s:%d: CHECK_STR(%s, %s) failed:\n  \"%s\"\n  \"%s\"\n", __FILE__, __LINE__, #a, #b, \
+                   _a.c_str(), _b.c_str()); \
+        } \
+    } while (0)
+
+int test_done(const char *name);
+
+/* lock_state() fails as if loop() held the lock, see sketch.cpp */
+extern bool host_state_busy;
+
+/* messages sent through mqtt_publish() by the module under test, see sketch.cpp */
+struct Published {
+    std::string topic;
+    std::string payload;
+    bool retained;
+};
+extern std::vector<Published> published;
+
+/* serialized document, for comparing against the expected text */
+std::string to_json(JsonDocument &doc);
+
+#endif
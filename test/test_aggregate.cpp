@@ -0,0 +1,139 @@
+/* min/max/mean windows */
+#include "test.h"
+#include "aggregate.h"
+
+static void frame(uint8_t ID, float temp, int8_t humi, bool temp_ok = true, bool humi_ok = true)
+{
+    SensorFrame f;
+    f.ID = ID;
+    f.temp = temp;
+    f.humi = humi;
+    agg_update(&f, temp_ok, humi_ok);
+}
+
+static std::string render(int w, int ID)
+{
+    String suffix;
+    JsonDocument json;
+    if (!agg_render(w, ID, suffix, json))
+        return "";
+    return to_json(json);
+}
+
+/* only what passed the plausibility filter is counted */
+static void test_filtered()
+{
+    config.agg_minutes[0] = 5;
+    agg_reset(0, 3);
+    frame(3, 20.0, 50);
+    frame(3, 35.0, 52, false, true);
+    frame(3, 20.4, 90, true, false);
+    CHECK_STR(render(0, 3), "{\"temp_min\":20.0,\"temp_max\":20.4,\"temp_mean\":20.2,"
+                            "\"humi_min\":50,\"humi_max\":52,\"humi_mean\":51.0,\"count\":2,\"window\":300}");
+    agg_reset(0, 3);
+    frame(3, 35.0, 52, false, true);
+    CHECK_STR(render(0, 3), "{\"humi_min\":52,\"humi_max\":52,\"humi_mean\":52.0,\"count\":0,\"window\":300}");
+    agg_reset(0, 3);
+    frame(3, 35.0, 52, false, false);
+    CHECK_STR(render(0, 3), "");
+}
+
+/* a new length or disabling the window discards what was collected */
+static void test_config_change()
+{
+    config.agg_minutes[0] = 5;
+    frame(3, 20.0, 50);
+    CHECK(!agg_window_due(0));
+    CHECK(render(0, 3) != "");
+    config.agg_minutes[0] = 10;
+    CHECK(!agg_window_due(0));
+    CHECK_STR(render(0, 3), "");
+
+    frame(3, 20.0, 50);
+    config.agg_minutes[0] = 0;
+    CHECK(!agg_window_due(0));
+    config.agg_minutes[0] = 10;
+    frame(3, 21.0, 50);   /* also noticed by agg_update() */
+    CHECK_STR(render(0, 3), "{\"temp_min\":21.0,\"temp_max\":21.0,\"temp_mean\":21.0,"
+                            "\"humi_min\":50,\"humi_max\":50,\"humi_mean\":50.0,\"count\":1,\"window\":600}");
+    /* a new length starts a new window, it is not due right away */
+    CHECK(!agg_window_due(0));
+}
+
+/* once the time is set, windows end on wall clock boundaries */
+static void test_wallclock()
+{
+    config.agg_minutes[0] = 60;
+    config.agg_minutes[1] = 5;
+    CHECK(!agg_window_due(0));
+    CHECK(!agg_window_due(1));
+    host_set_wallclock(1760000400 - 600);  /* 10 minutes before a full hour */
+    /* the running windows go on to the next boundary */
+    CHECK(!agg_window_due(0));
+    CHECK(!agg_window_due(1));
+    host_advance_ms(299 * 1000UL);
+    CHECK(!agg_window_due(1));
+    host_advance_ms(1000);
+    CHECK(agg_window_due(1));              /* five to */
+    host_advance_ms(299 * 1000UL);
+    CHECK(!agg_window_due(0));
+    host_advance_ms(1000);
+    CHECK(agg_window_due(0));              /* full hour */
+    CHECK(agg_window_due(1));
+    host_advance_ms(3599 * 1000UL);
+    CHECK(!agg_window_due(0));
+    host_advance_ms(1000);
+    CHECK(agg_window_due(0));
+}
+
+int main()
+{
+    config.agg_minutes[0] = 5;
+    config.agg_minutes[1] = 60;
+
+    /* the clock starts in the first window */
+    CHECK(!agg_window_due(0));
+    CHECK(!agg_window_due(1));
+
+    frame(7, 21.5, 40);
+    frame(7, 22.0, 45);
+    frame(7, 20.9, 106);    /* no humidity in this one */
+    frame(9, -3.4, 0);
+
+    String suffix;
+    JsonDocument json;
+    CHECK(agg_render(0, 7, suffix, json));
+    CHECK_STR(suffix.c_str(), "agg/5m");
+    CHECK_STR(to_json(json), "{\"temp_min\":20.9,\"temp_max\":22.0,\"temp_mean\":21.5,"
+                             "\"humi_min\":40,\"humi_max\":45,\"humi_mean\":42.5,\"count\":3,\"window\":300}");
+    json.clear();
+    CHECK(agg_render(1, 7, suffix, json));
+    CHECK_STR(suffix.c_str(), "agg/1h");
+    json.clear();
+    CHECK(agg_render(0, 9, suffix, json));
+    CHECK_STR(to_json(json), "{\"temp_min\":-3.4,\"temp_max\":-3.4,\"temp_mean\":-3.4,\"count\":1,\"window\":300}");
+    json.clear();
+    CHECK(!agg_render(0, 8, suffix, json));
+
+    /* due once per window boundary */
+    host_advance_ms(5 * 60 * 1000UL);
+    CHECK(agg_window_due(0));
+    CHECK(!agg_window_due(0));
+    CHECK(!agg_window_due(1));
+    agg_reset(0, 7);
+    CHECK(!agg_render(0, 7, suffix, json));
+    CHECK(agg_render(1, 7, suffix, json));
+
+    /* a disabled window collects nothing */
+    config.agg_minutes[1] = 0;
+    agg_reset(1, 9);
+    frame(9, 1.0, 50);
+    CHECK(!agg_window_due(1));
+    json.clear();
+    CHECK(!agg_render(1, 9, suffix, json));
+
+    test_filtered();
+    test_config_change();
+    test_wallclock();
+    return test_done("aggregate");
+}
@@ -0,0 +1,277 @@
+/*
+ * Three gateways sharing ten sensors through a stand-in for the broker, which
+ * keeps retained messages, delivers with a delay and sends last wills.
+ * Every frame has to be published by exactly one connected gateway, also
+ * around reconnects, takeovers and peers that vanish.
+ */
+#include "test.h"
+#include "cluster.h"
+#include "mempool.h"
+#include <map>
+
+#define GATEWAYS 3
+#define SENSORS 10
+#define STEP_MS 100
+
+struct Gateway {
+    Config *config;
+    String *mqtt_id;
+    bool *mqtt_ok;
+    void (*heard)(uint8_t ID, int rssi);
+    bool (*owns)(uint8_t ID);
+    bool (*owned)(uint8_t ID);
+    void (*connected)();
+    void (*receive)(char *topic, uint8_t *payload, unsigned int len);
+    void (*job)();
+    void (*json)(JsonObject obj);
+};
+
+static void broker_publish(const char *topic, const uint8_t *payload, unsigned int len, bool retained);
+
+namespace gw0 {
+#include "cluster_gw.h"
+}
+namespace gw1 {
+#include "cluster_gw.h"
+}
+namespace gw2 {
+#include "cluster_gw.h"
+}
+
+static Gateway *gw[GATEWAYS] = { &gw0::gateway, &gw1::gateway, &gw2::gateway };
+
+/* broker */
+struct Delivery {
+    unsigned long at;
+    int to;
+    std::string topic, payload;
+};
+static std::map<std::string, std::string> retained_msgs;
+static std::vector<Delivery> pending;
+static bool subscribed[GATEWAYS];
+static const unsigned long delay_ms = 500;
+
+static void broker_publish(const char *topic, const uint8_t *payload, unsigned int len, bool retained)
+{
+    std::string t(topic), p((const char *)payload, len);
+    if (retained) {
+        if (len)
+            retained_msgs[t] = p;
+        else
+            retained_msgs.erase(t);
+    }
+    if (t.compare(0, strlen(CLUSTER_TOPIC), CLUSTER_TOPIC) != 0)
+        return;
+    for (int g = 0; g < GATEWAYS; g++)
+        if (subscribed[g])
+            pending.push_back({ millis() + delay_ms, g, t, p });
+}
+
+static void broker_deliver()
+{
+    for (size_t i = 0; i < pending.size();) {
+        Delivery d = pending[i];
+        if ((long)(millis() - d.at) < 0) {
+            i++;
+            continue;
+        }
+        pending.erase(pending.begin() + i);
+        if (!subscribed[d.to])
+            continue;
+        std::vector<char> topic(d.topic.begin(), d.topic.end());
+        topic.push_back(0);
+        gw[d.to]->receive(topic.data(), (uint8_t *)d.payload.data(), d.payload.size());
+    }
+}
+
+static void connect(int g)
+{
+    *gw[g]->mqtt_ok = true;
+    gw[g]->connected();
+    subscribed[g] = true;
+    for (auto &m : retained_msgs)
+        pending.push_back({ millis() + delay_ms, g, m.first, m.second });
+}
+
+/* connection lost, the broker sends the last will if it notices */
+static void disconnect(int g, bool will)
+{
+    *gw[g]->mqtt_ok = false;
+    subscribed[g] = false;
+    if (will)
+        broker_publish((CLUSTER_TOPIC + *gw[g]->mqtt_id).c_str(), (const uint8_t *)"", 0, true);
+}
+
+/* radio: sensors 0-4 are close to gw0, 5-9 close to gw1, gw2 is in the middle */
+static int rssi[GATEWAYS][SENSORS];
+static bool radio_on[GATEWAYS] = { true, true, true };
+
+struct Counts {
+    uint32_t frames, missed, duplicates;
+    uint32_t by[GATEWAYS][SENSORS];
+};
+static Counts counts;
+
+static void send_frame(int ID)
+{
+    int publishers = 0;
+    for (int g = 0; g < GATEWAYS; g++) {
+        if (!radio_on[g] || !rssi[g][ID])
+            continue;
+        gw[g]->heard(ID, rssi[g][ID] + (int)(millis() / 4000 % 3) - 1);
+        if (gw[g]->owns(ID) && *gw[g]->mqtt_ok) {
+            publishers++;
+            counts.by[g][ID]++;
+        }
+    }
+    counts.frames++;
+    if (publishers == 0)
+        counts.missed++;
+    else if (publishers > 1)
+        counts.duplicates++;
+}
+
+static void run_ms(unsigned long ms)
+{
+    for (unsigned long t = 0; t < ms; t += STEP_MS) {
+        unsigned long now = millis();
+        for (int ID = 0; ID < SENSORS; ID++)
+            if ((now + ID * 300) % 4000 < STEP_MS)
+                send_frame(ID);
+        broker_deliver();
+        for (int g = 0; g < GATEWAYS; g++)
+            gw[g]->job();
+        host_advance_ms(STEP_MS);
+    }
+}
+
+/* the only gateway that published ID in the last run, -1 if none or more than one */
+static int publisher(int ID)
+{
+    int p = -1;
+    for (int g = 0; g < GATEWAYS; g++) {
+        if (!counts.by[g][ID])
+            continue;
+        if (p >= 0)
+            return -1;
+        p = g;
+    }
+    return p;
+}
+
+static void reset_counts()
+{
+    memset(&counts, 0, sizeof(counts));
+}
+
+static int takeovers(int g)
+{
+    JsonDocument doc;
+    gw[g]->json(doc.to<JsonObject>());
+    return doc["takeovers"].as<int>();
+}
+
+int main()
+{
+    for (int g = 0; g < GATEWAYS; g++) {
+        gw[g]->config->cluster = true;
+        *gw[g]->mqtt_id = String("gw") + String(g);
+    }
+    for (int ID = 0; ID < SENSORS; ID++) {
+        rssi[0][ID] = ID < 5 ? -60 : -80;
+        rssi[1][ID] = ID < 5 ? -80 : -60;
+        rssi[2][ID] = -70;
+    }
+
+    /* start one after another, the best receiver owns each sensor */
+    for (int g = 0; g < GATEWAYS; g++) {
+        connect(g);
+        run_ms(1000);
+    }
+    run_ms(3 * 60 * 1000UL);
+    reset_counts();
+    run_ms(2 * 60 * 1000UL);
+    CHECK_EQ(counts.missed, 0);
+    CHECK_EQ(counts.duplicates, 0);
+    for (int ID = 0; ID < SENSORS; ID++)
+        CHECK_EQ(publisher(ID), ID < 5 ? 0 : 1);
+
+    /* short connection loss of a gateway that owns nothing: it keeps its peers, no duplicates */
+    disconnect(2, false);
+    run_ms(10 * 1000UL);
+    reset_counts();
+    connect(2);
+    for (int ID = 0; ID < SENSORS; ID++)
+        send_frame(ID);
+    run_ms(60 * 1000UL);
+    CHECK_EQ(counts.duplicates, 0);
+    CHECK_EQ(counts.missed, 0);
+
+    /* same for an owner, it goes on publishing its sensors after the reconnect */
+    disconnect(0, false);
+    run_ms(10 * 1000UL);
+    reset_counts();
+    connect(0);
+    for (int ID = 0; ID < SENSORS; ID++)
+        send_frame(ID);
+    run_ms(60 * 1000UL);
+    CHECK_EQ(counts.duplicates, 0);
+    CHECK_EQ(counts.missed, 0);
+    for (int ID = 0; ID < SENSORS; ID++)
+        CHECK_EQ(publisher(ID), ID < 5 ? 0 : 1);
+
+    /* a better receiver takes over only beyond the hysteresis */
+    rssi[2][0] = -57;
+    run_ms(3 * 60 * 1000UL);
+    reset_counts();
+    run_ms(60 * 1000UL);
+    CHECK_EQ(publisher(0), 0);
+    rssi[2][0] = -50;
+    run_ms(3 * 60 * 1000UL);
+    reset_counts();
+    run_ms(60 * 1000UL);
+    CHECK_EQ(publisher(0), 2);
+    CHECK_EQ(counts.duplicates, 0);
+    CHECK_EQ(counts.missed, 0);
+
+    /* gw1 vanishes, the broker sends its last will: taken over within seconds */
+    disconnect(1, true);
+    radio_on[1] = false;
+    run_ms(10 * 1000UL);
+    reset_counts();
+    run_ms(60 * 1000UL);
+    CHECK_EQ(counts.duplicates, 0);
+    CHECK_EQ(counts.missed, 0);
+    for (int ID = 5; ID < SENSORS; ID++)
+        CHECK_EQ(publisher(ID), 2);
+
+    /* gw2 (sensors 0, 5-9) vanishes without last will: taken over after a few frames */
+    reset_counts();
+    disconnect(2, false);
+    radio_on[2] = false;
+    run_ms(CLUSTER_PEER_TIMEOUT_MS + 2 * CLUSTER_FRAME_MS);
+    printf("cluster: %u frames missed after a peer vanished without last will\n", counts.missed);
+    CHECK(counts.missed > 0);
+    CHECK(counts.missed <= 6 * (CLUSTER_PEER_TIMEOUT_MS / CLUSTER_FRAME_MS + 2));
+    CHECK_EQ(counts.duplicates, 0);
+    reset_counts();
+    run_ms(60 * 1000UL);
+    CHECK_EQ(counts.duplicates, 0);
+    CHECK_EQ(counts.missed, 0);
+    for (int ID = 0; ID < SENSORS; ID++)
+        CHECK_EQ(publisher(ID), 0);
+
+    /* reading the ownership for display changes nothing, even if an election would */
+    JsonDocument before;
+    gw[0]->json(before.to<JsonObject>());
+    host_advance_ms(CLUSTER_HEARD_MS);
+    for (int ID = 0; ID < SENSORS; ID++)
+        CHECK(gw[0]->owned(ID));
+    JsonDocument after;
+    gw[0]->json(after.to<JsonObject>());
+    CHECK_EQ(after["handovers"].as<int>(), before["handovers"].as<int>());
+    CHECK_EQ(after["owned"].as<int>(), 0); /* none heard recently */
+
+    printf("cluster: takeovers %d / %d / %d\n", takeovers(0), takeovers(1), takeovers(2));
+    return test_done("cluster");
+}
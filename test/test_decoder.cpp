@@ -0,0 +1,162 @@
+/* decoder registry and LaCrosse decoding, plus the dispatch cost benchmark */
+#include "test.h"
+#include "decoder.h"
+#include "lacrosse.h"
+#include <chrono>
+
+/* a second registry with two more decoders on the LaCrosse start nibble, told apart by length */
+static bool short_frame(byte *, SensorFrame *f)
+{
+    f->ID = 1;
+    return true;
+}
+
+static bool long_frame(byte *, SensorFrame *f)
+{
+    f->ID = 2;
+    return true;
+}
+
+namespace more {
+#define DECODERS_EXTRA \
+    { "Short", 3, NIBBLE(0x9), RATE_17241, short_frame, short_frame }, \
+    { "Long", 7, NIBBLE(0x9) | NIBBLE(0xA), RATE_9579, long_frame, long_frame },
+#include "../decoder.cpp"
+#undef DECODERS_EXTRA
+}
+
+/* same layout as radio_sim.h, temperature as (T + 40) * 10 */
+static void make_frame(uint8_t *f, uint8_t id, int t, uint8_t humi, bool init, bool batlo)
+{
+    f[0] = 0x90 | ((id >> 2) & 0x0f);
+    f[1] = ((id & 0x03) << 6) | (init ? 0x20 : 0) | (t / 100);
+    f[2] = (((t / 10) % 10) << 4) | (t % 10);
+    f[3] = (batlo ? 0x80 : 0) | humi;
+    f[4] = LaCrosse::CalculateCRC(f, FRAME_LENGTH - 1);
+}
+
+static bool decode(uint8_t *data, int rate_idx, SensorFrame *f)
+{
+    static const int rates[NUM_DATARATES] = { 9579, 17241 };
+    const Decoder *dec = decoder_find(data, FRAME_LENGTH, rate_idx);
+    if (!dec)
+        return false;
+    f->rate = rates[rate_idx];
+    return dec->TryHandleData(data, f);
+}
+
+static void test_decode()
+{
+    uint8_t data[FRAME_LENGTH];
+    SensorFrame f;
+
+    make_frame(data, 17, 615, 45, false, false);
+    CHECK(decode(data, 1, &f));
+    CHECK_EQ(f.ID, 17);
+    CHECK(fabs(f.temp - 21.5) < 0.01);
+    CHECK_EQ(f.humi, 45);
+    CHECK_EQ(f.init, 0);
+    CHECK_EQ(f.batlo, 0);
+
+    /* slow sensors get +128 */
+    CHECK(decode(data, 0, &f));
+    CHECK_EQ(f.ID, 17 | 0x80);
+
+    /* second channel gets +64 */
+    make_frame(data, 17, 388, 0x7d, true, true);
+    CHECK(decode(data, 1, &f));
+    CHECK_EQ(f.ID, 17 | 0x40);
+    CHECK(fabs(f.temp - -1.2) < 0.01);
+    CHECK_EQ(f.init, 1);
+    CHECK_EQ(f.batlo, 1);
+
+    /* bad CRC */
+    make_frame(data, 17, 615, 45, false, false);
+    data[4] ^= 0x01;
+    CHECK(!decode(data, 1, &f));
+}
+
+static void test_dispatch()
+{
+    uint8_t data[FRAME_LENGTH];
+    make_frame(data, 5, 615, 45, false, false);
+    CHECK(decoder_find(data, FRAME_LENGTH, 0) != NULL);
+    CHECK(decoder_find(data, FRAME_LENGTH, 1) != NULL);
+    CHECK(strcmp(decoder_find(data, FRAME_LENGTH, 1)->name, "LaCrosse") == 0);
+    /* wrong length, unknown data rate */
+    CHECK(decoder_find(data, FRAME_LENGTH - 1, 1) == NULL);
+    CHECK(decoder_find(data, 0, 1) == NULL);
+    CHECK(decoder_find(data, FRAME_LENGTH, -1) == NULL);
+    CHECK(decoder_find(data, FRAME_LENGTH, NUM_DATARATES) == NULL);
+    /* no decoder for any other start nibble */
+    for (int n = 0; n < 16; n++) {
+        data[0] = (n << 4) | 1;
+        CHECK((decoder_find(data, FRAME_LENGTH, 1) != NULL) == (n == 9));
+    }
+}
+
+static void test_shared_nibble()
+{
+    uint8_t data[8] = { 0x91 };
+    CHECK(strcmp(more::decoder_find(data, FRAME_LENGTH, 1)->name, "LaCrosse") == 0);
+    CHECK(strcmp(more::decoder_find(data, 3, 1)->name, "Short") == 0);
+    CHECK(more::decoder_find(data, 7, 1) == NULL);
+    CHECK(strcmp(more::decoder_find(data, FRAME_LENGTH, 0)->name, "LaCrosse") == 0);
+    CHECK(strcmp(more::decoder_find(data, 7, 0)->name, "Long") == 0);
+    CHECK(more::decoder_find(data, 3, 0) == NULL);
+    CHECK(more::decoder_find(data, 4, 1) == NULL);
+    data[0] = 0xA1;
+    CHECK(strcmp(more::decoder_find(data, 7, 0)->name, "Long") == 0);
+    CHECK(more::decoder_find(data, FRAME_LENGTH, 0) == NULL);
+    SensorFrame f;
+    CHECK(more::decoder_find(data, 7, 0)->TryHandleData(data, &f) && f.ID == 2);
+}
+
+static double ns_per_frame(std::chrono::steady_clock::time_point start, int n)
+{
+    std::chrono::duration<double, std::nano> d = std::chrono::steady_clock::now() - start;
+    return d.count() / n;
+}
+
+static void bench()
+{
+    const int N = 2000000;
+    const int FRAMES = 256;
+    static uint8_t known[FRAMES][FRAME_LENGTH], unknown[FRAMES][FRAME_LENGTH];
+    for (int i = 0; i < FRAMES; i++) {
+        make_frame(known[i], i % 64, 500 + i, 30 + i % 60, false, false);
+        memcpy(unknown[i], known[i], FRAME_LENGTH);
+        unknown[i][0] = (unknown[i][0] & 0x0f) | ((i % 9) << 4); /* start nibbles 0-8 */
+    }
+    volatile uint32_t sink = 0;
+
+    auto t = std::chrono::steady_clock::now();
+    for (int i = 0; i < N; i++)
+        sink += decoder_find(known[i % FRAMES], FRAME_LENGTH, i & 1) != NULL;
+    double find_ns = ns_per_frame(t, N);
+
+    t = std::chrono::steady_clock::now();
+    for (int i = 0; i < N; i++)
+        sink += decoder_find(unknown[i % FRAMES], FRAME_LENGTH, i & 1) != NULL;
+    double unknown_ns = ns_per_frame(t, N);
+
+    t = std::chrono::steady_clock::now();
+    for (int i = 0; i < N; i++) {
+        SensorFrame f;
+        sink += decode(known[i % FRAMES], i & 1, &f) ? f.ID : 0;
+    }
+    double decode_ns = ns_per_frame(t, N);
+
+    printf("bench: decoder_find %.1f ns/frame, unknown frames %.1f ns/frame, find + decode %.1f ns/frame\n",
+           find_ns, unknown_ns, decode_ns);
+    CHECK(sink > 0);
+}
+
+int main()
+{
+    test_decode();
+    test_dispatch();
+    test_shared_nibble();
+    bench();
+    return test_done("decoder");
+}
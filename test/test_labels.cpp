@@ -0,0 +1,62 @@
+/* label arena: lookup, replacement, compaction */
+#include "test.h"
+#include "labels.h"
+
+int main()
+{
+    LabelTable &t = labels;
+    CHECK(!t.has(3));
+    CHECK_STR(t.get(3), "");
+    CHECK_EQ(t.heap_size(), 0);
+
+    CHECK(t.set(3, String("Aussen")));
+    CHECK(t.set(10, String("Keller")));
+    CHECK(t.set(200, String("Bad OG")));
+    CHECK_STR(t.get(3), "Aussen");
+    CHECK_STR(t.lower(3), "aussen");
+    CHECK_STR(t.lower(200), "bad og");
+    CHECK_EQ(t.length(10), 6);
+    CHECK_EQ(t.count(), 3);
+    CHECK_EQ(t.used(), 3 * 2 * 7);
+    CHECK_EQ(t.heap_size(), 128);
+
+    /* unchanged, shorter and longer names */
+    CHECK(t.set(3, String("Aussen")));
+    CHECK_EQ(t.used(), 3 * 2 * 7);
+    CHECK(t.set(3, String("Nord")));
+    CHECK_STR(t.get(3), "Nord");
+    CHECK(t.set(10, String("Kellerabteil")));
+    CHECK_STR(t.get(10), "Kellerabteil");
+    CHECK_STR(t.get(200), "Bad OG");
+    CHECK_EQ(t.used(), 2 * 5 + 2 * 13 + 2 * 7);
+
+    /* removing one moves the others down, no holes */
+    CHECK(t.set(3, String("")));
+    CHECK(!t.has(3));
+    CHECK_EQ(t.count(), 2);
+    CHECK_EQ(t.used(), 2 * 13 + 2 * 7);
+    CHECK_STR(t.get(10), "Kellerabteil");
+    CHECK_STR(t.lower(10), "kellerabteil");
+    CHECK_STR(t.get(200), "Bad OG");
+
+    /* truncated to LABEL_MAX_LEN */
+    std::string longname(100, 'X');
+    CHECK(t.set(42, longname.c_str(), longname.size()));
+    CHECK_EQ(t.length(42), LABEL_MAX_LEN);
+    CHECK_EQ(strlen(t.get(42)), LABEL_MAX_LEN);
+
+    /* all IDs, the arena grows in steps */
+    for (int i = 0; i < SENSOR_NUM; i++)
+        CHECK(t.set(i, String("sensor ") + String(i)));
+    CHECK_EQ(t.count(), SENSOR_NUM);
+    CHECK_STR(t.get(255), "sensor 255");
+    CHECK_STR(t.lower(0), "sensor 0");
+    CHECK_EQ(t.heap_size() % 128, 0);
+    CHECK(t.heap_size() >= t.used());
+
+    t.clear();
+    CHECK_EQ(t.count(), 0);
+    CHECK_EQ(t.used(), 0);
+    CHECK_EQ(t.heap_size(), 0);
+    return test_done("labels");
+}
@@ -0,0 +1,192 @@
+/*
+ * Fixed buffer pools and the JSON arena, then a soak run of the publishing
+ * paths that use them. This is a check of the pool logic only: documents
+ * come from the ArduinoJson stub, whose allocations differ from the
+ * library's, and the host heap says nothing about fragmentation on the
+ * device. What it does check is that the paths return every buffer and
+ * block, so the arena is reset and the pools never fall back to the heap,
+ * and that they leave nothing behind on the heap. For the latter, malloc()
+ * and friends are wrapped to count the bytes in use.
+ */
+#include "test.h"
+#include "mempool.h"
+#include "payload.h"
+#include "aggregate.h"
+#include <malloc.h>
+
+static void test_pool()
+{
+    char *buf[POOL_BUF_NUM + 1];
+    MemStats before = mem_stats[MEM_WEB];
+    for (int i = 0; i < POOL_BUF_NUM; i++) {
+        buf[i] = pool_get(MEM_WEB);
+        CHECK(buf[i] != NULL);
+        for (int j = 0; j < i; j++)
+            CHECK(buf[i] != buf[j]);
+    }
+    CHECK_EQ(mem_stats[MEM_WEB].in_use, POOL_BUF_NUM * POOL_BUF_SIZE);
+    CHECK_EQ(mem_stats[MEM_WEB].fallbacks, before.fallbacks);
+    /* exhausted: heap, counted */
+    buf[POOL_BUF_NUM] = pool_get(MEM_WEB);
+    CHECK(buf[POOL_BUF_NUM] != NULL);
+    CHECK_EQ(mem_stats[MEM_WEB].fallbacks, before.fallbacks + 1);
+    for (int i = 0; i <= POOL_BUF_NUM; i++)
+        pool_put(MEM_WEB, buf[i]);
+    CHECK_EQ(mem_stats[MEM_WEB].in_use, 0);
+    CHECK_EQ(mem_stats[MEM_WEB].peak, POOL_BUF_NUM * POOL_BUF_SIZE);
+    /* too big for a pool buffer */
+    char *big = pool_get(MEM_MQTT, POOL_BUF_SIZE + 1);
+    CHECK_EQ(mem_stats[MEM_MQTT].fallbacks, 1);
+    pool_put(MEM_MQTT, big);
+    mem_stats[MEM_WEB] = MemStats();
+    mem_stats[MEM_MQTT] = MemStats();
+}
+
+static void test_json_pool()
+{
+    static uint8_t mem[256] __attribute__((aligned(8)));
+    JsonPool pool(mem, sizeof(mem), MEM_HASS);
+    ArduinoJson::Allocator &a = pool;
+    void *p1 = a.allocate(10);
+    void *p2 = a.allocate(20);
+    CHECK((uint8_t *)p1 >= mem && (uint8_t *)p2 < mem + sizeof(mem));
+    CHECK_EQ(((uintptr_t)p2) % 8, 0);
+    CHECK_EQ(mem_stats[MEM_HASS].in_use, 8 + 16 + 8 + 24);
+    /* the last block grows and shrinks in place */
+    CHECK(a.reallocate(p2, 100) == p2);
+    CHECK(a.reallocate(p2, 30) == p2);
+    CHECK_EQ(mem_stats[MEM_HASS].in_use, 8 + 16 + 8 + 32);
+    /* an older block moves */
+    void *p3 = a.reallocate(p1, 40);
+    CHECK(p3 != p1);
+    CHECK((uint8_t *)p3 >= mem && (uint8_t *)p3 < mem + sizeof(mem));
+    /* full: heap */
+    void *p4 = a.allocate(1000);
+    CHECK(p4 != NULL && ((uint8_t *)p4 < mem || (uint8_t *)p4 >= mem + sizeof(mem)));
+    CHECK_EQ(mem_stats[MEM_HASS].fallbacks, 1);
+    a.deallocate(p4);
+    a.deallocate(p2);
+    CHECK(mem_stats[MEM_HASS].in_use > 0);
+    a.deallocate(p3);
+    /* all released, the arena starts over */
+    CHECK_EQ(mem_stats[MEM_HASS].in_use, 0);
+    CHECK(a.allocate(8) == p1);
+}
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+
+static size_t heap_bytes;
+
+void *malloc(size_t size)
+{
+    void *p = __libc_malloc(size);
+    if (p)
+        heap_bytes += malloc_usable_size(p);
+    return p;
+}
+
+void *calloc(size_t n, size_t size)
+{
+    void *p = __libc_calloc(n, size);
+    if (p)
+        heap_bytes += malloc_usable_size(p);
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    size_t old = ptr ? malloc_usable_size(ptr) : 0;
+    void *p = __libc_realloc(ptr, size);
+    if (p || size == 0)
+        heap_bytes -= old;
+    if (p)
+        heap_bytes += malloc_usable_size(p);
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr)
+        heap_bytes -= malloc_usable_size(ptr);
+    __libc_free(ptr);
+}
+}
+
+static size_t heap_in_use()
+{
+    return heap_bytes;
+}
+
+/* two days of 30 sensors every 4 s, cycling through the payload modes every hour */
+static void soak()
+{
+    const int SENSORS = 30;
+    const unsigned long HOURS = 48;
+    const uint8_t modes[][2] = { { PAYLOAD_TOPICS, 0 }, { PAYLOAD_JSON, 0 }, { PAYLOAD_MSGPACK, 0 },
+                                 { PAYLOAD_JSON, 10 }, { PAYLOAD_MSGPACK, 10 } };
+    config.agg_minutes[0] = 5;
+    config.agg_minutes[1] = 60;
+    for (int s = 0; s < MEM_SUBSYS; s++)
+        mem_stats[s] = MemStats();
+    size_t baseline = 0, max_growth = 0;
+    uint32_t frames = 0;
+    for (unsigned long h = 0; h < HOURS; h++) {
+        config.payload_mode = modes[h % 5][0];
+        config.batch_ms = modes[h % 5][1] * 100;
+        for (unsigned long t = 0; t < 3600; t += 4) {
+            for (int i = 0; i < SENSORS; i++) {
+                SensorFrame f;
+                memset(&f, 0, sizeof(f));
+                f.ID = i * 7 + (h & 1);
+                f.temp = 10.0 + ((frames * 7) % 300) / 10.0;
+                f.humi = 30 + (frames % 60);
+                f.rssi = -60 - i;
+                f.rate = 17241;
+                f.rx_us = (uint32_t)esp_timer_get_time();
+                agg_update(&f, true, true);
+                publish_frame(&f);
+                frames++;
+            }
+            host_advance_ms(4000);
+            flush_batch();
+            for (int w = 0; w < AGG_WINDOWS; w++) {
+                if (!agg_window_due(w))
+                    continue;
+                String suffix;
+                for (int i = 0; i < SENSOR_NUM; i++) {
+                    JsonDocument json(&json_pool);
+                    if (!agg_render(w, i, suffix, json))
+                        continue;
+                    mqtt_publish(pub_base + String(i, DEC) + "/" + suffix, json);
+                    agg_reset(w, i);
+                }
+            }
+            published.clear();
+        }
+        /* by now every mode has been used twice */
+        if (h == 10)
+            baseline = heap_in_use();
+        else if (h > 10 && heap_in_use() > baseline)
+            max_growth = std::max(max_growth, heap_in_use() - baseline);
+    }
+    printf("soak (pool logic, stub ArduinoJson): %u frames, %u MQTT messages, json pool peak %u bytes, heap left behind %zu bytes\n",
+           frames, mqtt_stats.publishes, mem_stats[MEM_JSON].peak, max_growth);
+    CHECK_EQ(mem_stats[MEM_JSON].fallbacks, 0);
+    CHECK_EQ(mem_stats[MEM_JSON].in_use, 0);
+    CHECK_EQ(mem_stats[MEM_MQTT].fallbacks, 0);
+    CHECK(mem_stats[MEM_JSON].allocs > frames);
+    CHECK_EQ(max_growth, 0);
+}
+
+int main()
+{
+    host_set_wallclock(1760000000);
+    test_pool();
+    test_json_pool();
+    soak();
+    return test_done("mempool");
+}
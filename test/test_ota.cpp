@@ -0,0 +1,188 @@
+/* firmware update: format detection, inflating in upload sized chunks, failures */
+#include "test.h"
+#include "ota.h"
+#include <Update.h>
+#include <zlib.h>
+
+/* looks like an app image: 0xe9 magic, compressible, larger than the 32 kB window */
+static std::string make_image(size_t len)
+{
+    std::string img;
+    img.reserve(len);
+    uint32_t x = 12345;
+    while (img.size() < len) {
+        x = x * 1103515245 + 12345;
+        if ((x >> 16) & 3)
+            img += "lacrosse2mqtt firmware " + std::to_string((x >> 8) % 1000) + "\n";
+        else
+            img += (char)(x >> 24);
+    }
+    img.resize(len);
+    img[0] = (char)0xe9;
+    return img;
+}
+
+static std::string deflate_raw(const std::string &in, int window_bits)
+{
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    deflateInit2(&z, 9, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY);
+    std::string out(deflateBound(&z, in.size()), '\0');
+    z.next_in = (Bytef *)in.data();
+    z.avail_in = in.size();
+    z.next_out = (Bytef *)&out[0];
+    z.avail_out = out.size();
+    deflate(&z, Z_FINISH);
+    out.resize(z.total_out);
+    deflateEnd(&z);
+    return out;
+}
+
+static std::string make_zlib(const std::string &in)
+{
+    return deflate_raw(in, 15);
+}
+
+static void put32(std::string &s, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        s += (char)(v >> (8 * i));
+}
+
+/* gzip with all optional header fields, so the header is long and gets split across chunks */
+static std::string make_gzip(const std::string &in, bool all_fields)
+{
+    std::string gz("\x1f\x8b\x08", 3);
+    gz += (char)(all_fields ? 0x1e : 0x00);
+    gz += std::string("\0\0\0\0\0\x03", 6);
+    if (all_fields) {
+        gz += "\x05";
+        gz += '\0';
+        gz += "extra";
+        gz += "firmware.bin";
+        gz += '\0';
+        gz += std::string(100, 'c');
+        gz += '\0';
+        uint16_t crc = crc32(0, (const Bytef *)gz.data(), gz.size()) & 0xffff;
+        gz += (char)(crc & 0xff);
+        gz += (char)(crc >> 8);
+    }
+    gz += deflate_raw(in, -15);
+    put32(gz, crc32(0, (const Bytef *)in.data(), in.size()));
+    put32(gz, in.size());
+    return gz;
+}
+
+/* uploads data in chunks of the given size like handle_update_upload(), returns the result of ota_end() */
+static bool upload(const std::string &data, size_t chunk, const std::string &md5)
+{
+    ota_begin(String(md5.c_str()));
+    for (size_t i = 0; i < data.size(); i += chunk)
+        ota_write((const uint8_t *)data.data() + i, std::min(chunk, data.size() - i));
+    return ota_end();
+}
+
+static bool status_ok()
+{
+    return strncmp(ota_status().c_str(), "Update OK", 9) == 0;
+}
+
+static void test_formats()
+{
+    const std::string img = make_image(200000);
+    const std::string md5 = md5_hex(img);
+    const std::string zlib = make_zlib(img), gzip = make_gzip(img, false), gzip_all = make_gzip(img, true);
+    const size_t chunks[] = { 1, 7, 1460, 1 << 20 };
+    CHECK(zlib.size() < img.size() / 2);
+
+    for (size_t chunk : chunks) {
+        CHECK(upload(img, chunk, ""));
+        CHECK(Update.done && Update.image == img);
+        CHECK(upload(img, chunk, md5));
+        CHECK(Update.done && Update.image == img);
+        CHECK(upload(zlib, chunk, md5));
+        CHECK(Update.done && Update.image == img);
+        CHECK(upload(gzip, chunk, md5));
+        CHECK(Update.done && Update.image == img);
+        CHECK(upload(gzip_all, chunk, md5));
+        CHECK(Update.done && Update.image == img);
+        CHECK(status_ok());
+    }
+
+    /* a first chunk of one byte, then the rest: the format is only known with the second one */
+    CHECK(ota_begin(String(md5.c_str())));
+    CHECK(ota_write((const uint8_t *)gzip_all.data(), 1));
+    CHECK(ota_write((const uint8_t *)gzip_all.data() + 1, gzip_all.size() - 1));
+    CHECK(ota_end());
+    CHECK(Update.image == img);
+
+    /* too short to tell the format */
+    CHECK(!upload(std::string("\xe9", 1), 1, ""));
+    CHECK(strstr(ota_status().c_str(), "no image") != NULL);
+}
+
+static void test_errors()
+{
+    const std::string img = make_image(100000);
+    const std::string md5 = md5_hex(img);
+    const std::string zlib = make_zlib(img), gzip = make_gzip(img, true);
+
+    /* compressed needs the md5 of the uncompressed image */
+    CHECK(!upload(zlib, 1460, ""));
+    CHECK(!upload(gzip, 1460, ""));
+    CHECK(!Update.isRunning());
+
+    /* wrong md5 */
+    std::string bad = md5;
+    bad[0] = bad[0] == '0' ? '1' : '0';
+    CHECK(!upload(img, 1460, bad));
+    CHECK(!upload(gzip, 1460, bad));
+    CHECK(!Update.done);
+    CHECK(strstr(ota_status().c_str(), "MD5") != NULL);
+
+    /* truncated */
+    CHECK(!upload(gzip.substr(0, gzip.size() / 2), 1460, md5));
+    CHECK(strstr(ota_status().c_str(), "truncated") != NULL);
+    CHECK(!upload(gzip.substr(0, 20), 7, md5));
+    CHECK(!upload(std::string(), 1460, md5));
+    CHECK(strstr(ota_status().c_str(), "no image") != NULL);
+
+    /* corrupt deflate data */
+    std::string corrupt = zlib;
+    for (size_t i = 100; i < 200; i++)
+        corrupt[i] = 0xff;
+    CHECK(!upload(corrupt, 1460, md5));
+    CHECK(!Update.done);
+
+    /* not deflate, and a header that never ends */
+    std::string gz_cm = gzip;
+    gz_cm[2] = 7;
+    CHECK(!upload(gz_cm, 1460, md5));
+    CHECK(strstr(ota_status().c_str(), "invalid gzip header") != NULL);
+    std::string endless("\x1f\x8b\x08\x08\0\0\0\0\0\x03", 10);
+    endless += std::string(1000, 'x');
+    CHECK(!upload(endless, 100, md5));
+    CHECK(strstr(ota_status().c_str(), "too long") != NULL);
+
+    /* flash write error */
+    Update.fail_at = 50000;
+    CHECK(!upload(gzip, 1460, md5));
+    CHECK(strstr(ota_status().c_str(), "flash write") != NULL);
+    Update.fail_at = 0;
+
+    /* aborted in the middle, the next one works */
+    CHECK(ota_begin(String(md5.c_str())));
+    CHECK(ota_write((const uint8_t *)gzip.data(), 1000));
+    ota_abort();
+    CHECK(!ota_write((const uint8_t *)gzip.data() + 1000, 1000));
+    CHECK(!ota_end());
+    CHECK(upload(gzip, 1460, md5));
+    CHECK(Update.image == img);
+}
+
+int main()
+{
+    test_formats();
+    test_errors();
+    return test_done("ota");
+}
@@ -0,0 +1,154 @@
+/* payload modes: message contents, and bytes on the wire / publishes per second for each mode */
+#include "test.h"
+#include "payload.h"
+
+static SensorFrame make(uint8_t ID, float temp, int8_t humi)
+{
+    SensorFrame f;
+    memset(&f, 0, sizeof(f));
+    f.ID = ID;
+    f.temp = temp;
+    f.humi = humi;
+    f.rssi = -70;
+    f.rate = 17241;
+    f.rx_us = (uint32_t)esp_timer_get_time();
+    return f;
+}
+
+static bool starts_with(const std::string &s, const std::string &prefix)
+{
+    return s.compare(0, prefix.size(), prefix) == 0;
+}
+
+static void test_contents()
+{
+    SensorFrame f = make(17, 21.5, 45);
+    config.batch_ms = 0;
+
+    config.payload_mode = PAYLOAD_TOPICS;
+    published.clear();
+    publish_frame(&f);
+    CHECK_EQ(published.size(), 3);
+    CHECK_STR(published[0].topic, "lacrosse/id_17/temp");
+    CHECK_STR(published[0].payload, "21.5");
+    CHECK_STR(published[1].topic, "lacrosse/id_17/humi");
+    CHECK_STR(published[1].payload, "45");
+    CHECK_STR(published[2].topic, "lacrosse/id_17/state");
+    CHECK(starts_with(published[2].payload, "{\"low_batt\":\"false\",\"init\":\"false\",\"RSSI\":-70,\"baud\":17.241,"));
+
+    /* no humidity sensor */
+    published.clear();
+    f.humi = 106;
+    publish_frame(&f);
+    CHECK_EQ(published.size(), 2);
+    f.humi = 45;
+
+    config.payload_mode = PAYLOAD_JSON;
+    published.clear();
+    publish_frame(&f);
+    CHECK_EQ(published.size(), 1);
+    CHECK_STR(published[0].topic, "lacrosse/id_17/data");
+    CHECK(starts_with(published[0].payload, "{\"temp\":21.5,\"humi\":45,\"low_batt\":\"false\",\"init\":\"false\","
+                                            "\"RSSI\":-70,\"baud\":17.241,"));
+
+    config.payload_mode = PAYLOAD_MSGPACK;
+    published.clear();
+    publish_frame(&f);
+    CHECK_EQ(published.size(), 1);
+    CHECK_STR(published[0].topic, "lacrosse/id_17/msgpack");
+    /* map, "t": 215, "h": 45, "b": 0, "i": 0, "r": -70, "d": 17241 */
+    CHECK(starts_with(published[0].payload, std::string("\x88\xa1t\xcc\xd7\xa1h\x2d\xa1" "b\x00\xa1i\x00"
+                                                        "\xa1r\xd0\xba\xa1" "d\xcd\x43\x59", 23)));
+
+    /* batch: one message with all sensors, sent after batch_ms */
+    config.payload_mode = PAYLOAD_JSON;
+    config.batch_ms = 1000;
+    published.clear();
+    f.rx_us = (uint32_t)esp_timer_get_time();
+    publish_frame(&f);
+    host_advance_ms(600);
+    SensorFrame g = make(18, -2.0, 106);
+    publish_frame(&g);
+    flush_batch();
+    CHECK_EQ(published.size(), 0);
+    host_advance_ms(400);
+    flush_batch();
+    CHECK_EQ(published.size(), 1);
+    CHECK_STR(published[0].topic, "lacrosse/batch/data");
+    CHECK(starts_with(published[0].payload, "{\"17\":{\"temp\":21.5,"));
+    CHECK(published[0].payload.find(",\"18\":{\"temp\":-2.0,\"low_batt\"") != std::string::npos);
+    /* queue time until the batch is sent */
+    CHECK(published[0].payload.find("\"queue_ms\":1000},\"18\"") != std::string::npos);
+    CHECK(published[0].payload.find("\"queue_ms\":400}}") != std::string::npos);
+    flush_batch();
+    CHECK_EQ(published.size(), 1);
+}
+
+struct Mode {
+    const char *name;
+    uint8_t payload_mode;
+    uint16_t batch_ms;
+};
+
+/* SENSORS sensors sending every 4 s (spread out a bit) for MINUTES minutes, loop() every 10 ms */
+static void bench()
+{
+    const Mode modes[] = {
+        { "topics", PAYLOAD_TOPICS, 0 },
+        { "json", PAYLOAD_JSON, 0 },
+        { "msgpack", PAYLOAD_MSGPACK, 0 },
+        { "json, batch 5 s", PAYLOAD_JSON, 5000 },
+        { "msgpack, batch 5 s", PAYLOAD_MSGPACK, 5000 },
+    };
+    const int SENSORS = 20, MINUTES = 10, STEP_MS = 10;
+    const int n = sizeof(modes) / sizeof(modes[0]);
+    uint32_t pubs[n], bytes[n], frames = 0;
+
+    printf("bench: %d sensors, %d minutes\n", SENSORS, MINUTES);
+    printf("  %-20s %10s %10s %10s %10s\n", "mode", "publishes", "bytes", "pub/s", "bytes/s");
+    for (int m = 0; m < n; m++) {
+        config.payload_mode = modes[m].payload_mode;
+        config.batch_ms = modes[m].batch_ms;
+        mqtt_stats = MqttStats();
+        published.clear();
+        unsigned long next[SENSORS];
+        for (int i = 0; i < SENSORS; i++)
+            next[i] = millis() + i * 197;
+        frames = 0;
+        unsigned long end = millis() + MINUTES * 60000UL;
+        while ((long)(millis() - end) < 0) {
+            for (int i = 0; i < SENSORS; i++) {
+                if ((long)(millis() - next[i]) < 0)
+                    continue;
+                next[i] += 4000 + i * 10;
+                SensorFrame f = make(i, 15.0 + (frames % 100) / 10.0, 40 + i);
+                publish_frame(&f);
+                frames++;
+            }
+            flush_batch();
+            host_advance_ms(STEP_MS);
+        }
+        config.batch_ms = 0;
+        flush_batch();
+        pubs[m] = mqtt_stats.publishes;
+        bytes[m] = mqtt_stats.bytes;
+        printf("  %-20s %10u %10u %10.2f %10.1f\n", modes[m].name, pubs[m], bytes[m],
+               pubs[m] / (MINUTES * 60.0), bytes[m] / (MINUTES * 60.0));
+    }
+    CHECK_EQ(pubs[0], 3 * frames);
+    CHECK_EQ(pubs[1], frames);
+    CHECK_EQ(pubs[2], frames);
+    CHECK(pubs[3] < frames / 4);
+    CHECK(bytes[2] < bytes[1]);
+    CHECK(bytes[1] < bytes[0]);
+    CHECK(bytes[3] < bytes[1]);
+    CHECK(bytes[4] < bytes[3]);
+}
+
+int main()
+{
+    host_set_wallclock(1760000000); /* with "time" */
+    test_contents();
+    bench();
+    return test_done("payload");
+}
@@ -0,0 +1,337 @@
+/*
+ * QoS 1 publishing against a stand-in for the broker on the other end of the
+ * WiFiClient. The broker parses the PUBLISH packets and answers with PUBACKs
+ * that can be delayed or dropped, mixed with packets of its own, and the
+ * client reads them in chunks of different sizes like PubSubClient does.
+ */
+#include "test.h"
+#include "qos.h"
+#include <map>
+#include <set>
+
+#define STEP_MS 50
+
+struct Arrived {
+    std::string topic, payload;
+    uint16_t id;
+    bool dup;
+};
+
+class Broker : public HostPeer {
+public:
+    void received(const uint8_t *buf, size_t len) override {
+        _in.insert(_in.end(), buf, buf + len);
+        parse();
+    }
+
+    /* queue the PUBACKs that are due, with other traffic in between */
+    void step() {
+        unsigned long now = millis();
+        for (size_t i = 0; i < _acks.size();) {
+            if ((long)(now - _acks[i].first) < 0) {
+                i++;
+                continue;
+            }
+            uint16_t id = _acks[i].second;
+            _acks.erase(_acks.begin() + i);
+            outstanding.erase(id);
+            if (noise)
+                send_noise(id);
+            const uint8_t puback[] = { 0x40, 0x02, (uint8_t)(id >> 8), (uint8_t)(id & 0xff) };
+            rx.insert(rx.end(), puback, puback + 4);
+        }
+    }
+
+    std::vector<Arrived> arrived;
+    std::set<uint16_t> outstanding;     /* received, PUBACK not sent yet */
+    size_t max_outstanding = 0;
+    unsigned long ack_delay_ms = 200;
+    int drop_every = 0;                 /* do not acknowledge every n-th PUBLISH */
+    std::set<std::string> silent;       /* topics never acknowledged */
+    bool noise = false;
+    int qos0 = 0;                       /* PUBLISH packets without QoS 1 */
+
+private:
+    /* a QoS 0 PUBLISH with PUBACK look-alikes for the id in flight, longer than 127 bytes, and a PINGRESP */
+    void send_noise(uint16_t id) {
+        std::string payload(200, 'x');
+        for (int i = 0; i < 4; i++) {
+            payload[10 + 4 * i] = 0x40;
+            payload[11 + 4 * i] = 0x02;
+            payload[12 + 4 * i] = id >> 8;
+            payload[13 + 4 * i] = id & 0xff;
+        }
+        const std::string topic = "lacrosse/cluster/other";
+        size_t rem = 2 + topic.size() + payload.size();
+        rx.push_back(0x30);
+        rx.push_back((rem & 0x7f) | 0x80);
+        rx.push_back(rem >> 7);
+        rx.push_back(topic.size() >> 8);
+        rx.push_back(topic.size() & 0xff);
+        rx.insert(rx.end(), topic.begin(), topic.end());
+        rx.insert(rx.end(), payload.begin(), payload.end());
+        rx.push_back(0xd0);
+        rx.push_back(0x00);
+    }
+
+    void parse() {
+        for (;;) {
+            size_t pos = 1, rem = 0;
+            int shift = 0;
+            for (;;) {
+                if (pos >= _in.size())
+                    return;
+                uint8_t c = _in[pos++];
+                rem |= (size_t)(c & 0x7f) << shift;
+                shift += 7;
+                if (!(c & 0x80))
+                    break;
+            }
+            if (_in.size() < pos + rem)
+                return;
+            uint8_t hdr = _in[0];
+            const uint8_t *p = _in.data() + pos;
+            if ((hdr >> 4) == 3) {
+                size_t tlen = (p[0] << 8) | p[1];
+                Arrived a;
+                a.topic.assign((const char *)p + 2, tlen);
+                int qos = (hdr >> 1) & 3;
+                size_t off = 2 + tlen;
+                a.id = 0;
+                if (qos) {
+                    a.id = (p[off] << 8) | p[off + 1];
+                    off += 2;
+                }
+                a.dup = hdr & 0x08;
+                a.payload.assign((const char *)p + off, rem - off);
+                if (qos == 1) {
+                    arrived.push_back(a);
+                    acknowledge(a);
+                } else
+                    qos0++;
+            }
+            _in.erase(_in.begin(), _in.begin() + pos + rem);
+        }
+    }
+
+    void acknowledge(const Arrived &a) {
+        outstanding.insert(a.id);
+        max_outstanding = std::max(max_outstanding, outstanding.size());
+        _count++;
+        if (silent.count(a.topic) || (drop_every && _count % drop_every == 0)) {
+            outstanding.erase(a.id); /* the client will send it again */
+            return;
+        }
+        _acks.push_back({ millis() + ack_delay_ms, a.id });
+    }
+
+    std::vector<uint8_t> _in;
+    std::vector<std::pair<unsigned long, uint16_t>> _acks;
+    uint32_t _count = 0;
+};
+
+static Broker broker;
+
+/* PubSubClient reads single bytes in loop(), the chunked read is used by other clients */
+static void client_read(int chunk)
+{
+    uint8_t buf[64];
+    while (mqtt_link.available()) {
+        if (chunk == 1)
+            mqtt_link.read();
+        else
+            mqtt_link.read(buf, std::min(chunk, (int)sizeof(buf)));
+    }
+}
+
+static void run_ms(unsigned long ms, int chunk)
+{
+    for (unsigned long t = 0; t < ms; t += STEP_MS) {
+        broker.step();
+        client_read(chunk);
+        qos_job();
+        host_advance_ms(STEP_MS);
+    }
+}
+
+static int stat(const char *name)
+{
+    JsonDocument doc;
+    qos_json(doc.to<JsonObject>());
+    return doc[name].as<int>();
+}
+
+static bool publish(const std::string &topic, int value)
+{
+    String v(value);
+    return qos_publish(String(topic.c_str()), (const uint8_t *)v.c_str(), v.length(), false);
+}
+
+static std::string topic_of(int i)
+{
+    return "lacrosse/id_" + std::to_string(i) + "/temp";
+}
+
+/*
+ * Per topic, the values reach the broker in the order they were published,
+ * a retransmission has DUP set and repeats the value and the packet id.
+ * Returns the last value per topic.
+ */
+static std::map<std::string, int> check_order()
+{
+    std::map<std::string, int> last;
+    std::map<std::string, uint16_t> last_id;
+    for (const Arrived &a : broker.arrived) {
+        int v = atoi(a.payload.c_str());
+        auto it = last.find(a.topic);
+        if (it != last.end()) {
+            if (a.dup) {
+                CHECK_EQ(v, it->second);
+                CHECK_EQ(a.id, last_id[a.topic]);
+            } else
+                CHECK(v > it->second);
+        } else
+            CHECK(!a.dup);
+        last[a.topic] = v;
+        last_id[a.topic] = a.id;
+    }
+    return last;
+}
+
+/* sensors sending every second, the broker acknowledges after a delay, maybe not every message */
+static void traffic(int topics, unsigned long seconds, int chunk)
+{
+    broker.arrived.clear();
+    broker.max_outstanding = 0;
+    int sent0 = stat("sent"), acked0 = stat("acked");
+    int value = 0;
+    for (unsigned long s = 0; s < seconds; s++) {
+        value++;
+        for (int i = 0; i < topics; i++)
+            CHECK(publish(topic_of(i), value));
+        run_ms(1000, chunk);
+    }
+    run_ms(30 * 1000UL, chunk);
+    std::map<std::string, int> last = check_order();
+    CHECK_EQ(last.size(), topics);
+    for (auto &l : last)
+        CHECK_EQ(l.second, value);
+    CHECK(broker.max_outstanding <= (size_t)config.qos_window);
+    CHECK_EQ(stat("in_flight"), 0);
+    CHECK_EQ(stat("queued"), 0);
+    CHECK_EQ(stat("sent") - sent0, stat("acked") - acked0);
+}
+
+int main()
+{
+    host_peer = &broker;
+    config.qos1 = true;
+    config.qos_window = 4;
+    mqtt_ok = true;
+    mqtt_link.connect("broker", 1883);
+
+    /* delayed PUBACKs, read byte by byte or split across reads, mixed with other packets */
+    const int chunks[] = { 1, 3, 5, 64 };
+    for (int chunk : chunks) {
+        broker.noise = chunk != 64;
+        traffic(8, 30, chunk);
+    }
+    CHECK_EQ(stat("retransmits"), 0);
+    CHECK_EQ(stat("expired"), 0);
+    CHECK(broker.qos0 == 0);
+
+    /* slow broker: newer values replace waiting ones instead of piling up */
+    int replaced = stat("replaced");
+    broker.ack_delay_ms = 1500;
+    traffic(8, 30, 1);
+    CHECK(stat("replaced") > replaced);
+    CHECK_EQ(stat("expired"), 0);
+    broker.ack_delay_ms = 200;
+
+    /* lost PUBACKs: sent again with DUP until acknowledged */
+    broker.drop_every = 3;
+    traffic(8, 30, 1);
+    CHECK(stat("retransmits") > 0);
+    CHECK_EQ(stat("expired"), 0);
+    broker.drop_every = 0;
+
+    /* never acknowledged: given up after QOS_MAX_TRIES, the topic is free again */
+    broker.arrived.clear();
+    broker.silent.insert(topic_of(99));
+    CHECK(publish(topic_of(99), 1));
+    run_ms((QOS_MAX_TRIES + 1) * QOS_RETRY_MS, 1);
+    CHECK_EQ(stat("expired"), 1);
+    CHECK_EQ(broker.arrived.size(), QOS_MAX_TRIES);
+    broker.silent.clear();
+    broker.arrived.clear();
+    CHECK(publish(topic_of(99), 2));
+    run_ms(1000, 1);
+    CHECK_EQ(broker.arrived.size(), 1);
+    CHECK_EQ(stat("in_flight"), 0);
+
+    /* connection lost with messages in flight and half a PUBACK read: all sent again after the reconnect */
+    broker.ack_delay_ms = 100;
+    broker.arrived.clear();
+    for (int i = 0; i < 3; i++)
+        CHECK(publish(topic_of(i), 1000));
+    broker.step();
+    host_advance_ms(100);
+    broker.step();
+    uint8_t half[2];
+    CHECK_EQ(mqtt_link.read(half, 2), 2);
+    broker.up = false;
+    mqtt_ok = false;
+    broker.rx.clear();
+    CHECK(publish(topic_of(5), 1000));
+    run_ms(10 * 1000UL, 1);
+    CHECK_EQ(broker.arrived.size(), 3);
+    broker.up = true;
+    mqtt_link.connect("broker", 1883);
+    mqtt_ok = true;
+    qos_connected();
+    run_ms(5 * 1000UL, 1);
+    check_order();
+    CHECK_EQ(broker.arrived.size(), 3 + 3 + 1);
+    CHECK_EQ(stat("in_flight"), 0);
+    CHECK_EQ(stat("queued"), 0);
+
+    /*
+     * table full: for a topic in flight the oldest waiting message of another
+     * topic is dropped, topics with nothing in flight fall back to QoS 0
+     */
+    config.qos_window = 1;
+    for (int i = 0; i < QOS_SLOTS; i++)
+        broker.silent.insert(topic_of(i));
+    int overflow = stat("overflow"), downgraded = stat("downgraded");
+    replaced = stat("replaced");
+    for (int i = 0; i < QOS_SLOTS; i++)
+        CHECK(publish(topic_of(i), 2000));
+    CHECK_EQ(stat("in_flight"), 1);
+    CHECK_EQ(stat("queued"), QOS_SLOTS - 1);
+    CHECK(!publish(topic_of(QOS_SLOTS), 2000));
+    CHECK_EQ(stat("downgraded"), downgraded + 1);
+    CHECK(publish(topic_of(0), 2001));
+    CHECK_EQ(stat("overflow"), overflow + 1);
+    CHECK_EQ(stat("queued"), QOS_SLOTS - 1);
+    /* topic 1 was queued first, its message is gone */
+    CHECK(!publish(topic_of(1), 2001));
+    CHECK_EQ(stat("downgraded"), downgraded + 2);
+    CHECK(publish(topic_of(2), 2001));
+    CHECK_EQ(stat("replaced"), replaced + 1);
+    CHECK(publish(topic_of(0), 2002));
+    CHECK_EQ(stat("replaced"), replaced + 2);
+    CHECK_EQ(stat("overflow"), overflow + 1);
+    broker.silent.clear();
+    run_ms(60 * 1000UL, 1);
+    CHECK_EQ(stat("in_flight"), 0);
+    CHECK_EQ(stat("queued"), 0);
+    std::map<std::string, int> last = check_order();
+    CHECK_EQ(last[topic_of(0)], 2002);
+    CHECK(last[topic_of(1)] != 2000);
+    CHECK_EQ(last[topic_of(2)], 2001);
+    CHECK_EQ(last[topic_of(3)], 2000);
+
+    printf("qos: sent %d, acked %d, retransmits %d, replaced %d, overflow %d, downgraded %d\n", stat("sent"),
+           stat("acked"), stat("retransmits"), stat("replaced"), stat("overflow"), stat("downgraded"));
+    return test_done("qos");
+}
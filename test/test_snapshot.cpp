@@ -0,0 +1,176 @@
+/*
+ * Warm restart snapshot: round trip through RTC memory and the file, the
+ * checks of magic, version and CRC, the age of the restored entries and the
+ * discovery bits, which only survive if the label did not change.
+ * Includes ../snapshot.cpp to get at the RTC snapshot.
+ */
+#include "test.h"
+#include "labels.h"
+
+uint8_t hass_cfg[SENSOR_NUM];
+
+#include "../snapshot.cpp"
+
+static const uint8_t IDS[] = { 3, 17, 130, 255 };
+#define NUM_IDS (sizeof(IDS) / sizeof(IDS[0]))
+
+static void set_label(uint8_t ID, const char *name)
+{
+    labels.set(ID, name, strlen(name));
+}
+
+/* sensor IDS[i] was received i * 10 s ago, its discovery is announced; returns millis() */
+static unsigned long fill()
+{
+    memset(fcache, 0, sizeof(Cache) * SENSOR_NUM);
+    memset(hass_cfg, 0, sizeof(hass_cfg));
+    labels.clear();
+    for (size_t i = 0; i < NUM_IDS; i++) {
+        Cache *c = &fcache[IDS[i]];
+        c->timestamp = millis() - i * 10000;
+        for (int j = 0; j < FRAME_LENGTH; j++)
+            c->data[j] = IDS[i] + j;
+        c->rssi = -60 - i;
+        hass_cfg[IDS[i]] = 0x03 + i;
+        if (i != 2)
+            set_label(IDS[i], ("sensor " + std::to_string(i)).c_str());
+    }
+    return millis();
+}
+
+/* the restart: RAM is gone, the labels are loaded again before snap_restore() */
+static void reboot()
+{
+    memset(fcache, 0, sizeof(Cache) * SENSOR_NUM);
+    memset(hass_cfg, 0, sizeof(hass_cfg));
+    snap_restored = false;
+}
+
+/* filled and taken: millis() of fill() and of the snapshot */
+static bool restored(unsigned long filled, unsigned long taken)
+{
+    bool ok = true;
+    for (size_t i = 0; i < NUM_IDS; i++) {
+        Cache *c = &fcache[IDS[i]];
+        /* relative to the boot, with the age at the snapshot; 0 is an empty entry */
+        uint32_t age = taken - filled + i * 10000;
+        ok &= age ? (uint32_t)(0UL - c->timestamp) == age : c->timestamp == 1;
+        ok &= c->rssi == -60 - (int)i;
+        for (int j = 0; j < FRAME_LENGTH; j++)
+            ok &= c->data[j] == (uint8_t)(IDS[i] + j);
+    }
+    return ok;
+}
+
+static bool empty()
+{
+    for (int i = 0; i < SENSOR_NUM; i++)
+        if (fcache[i].timestamp != 0 || hass_cfg[i] != 0)
+            return false;
+    return true;
+}
+
+static void test_rtc()
+{
+    unsigned long filled = fill();
+    host_advance_ms(SNAP_INTERVAL_MS);
+    snap_job();
+    unsigned long taken = millis();
+    reboot();
+    set_label(IDS[0], "sensor 0");
+    set_label(IDS[1], "renamed");   /* announced as "sensor 1" */
+    set_label(IDS[2], "new");       /* had no label */
+    labels.set(IDS[3], "", 0);      /* label removed */
+    CHECK(snap_restore());
+    CHECK(snap_restored);
+    CHECK(restored(filled, taken));
+    CHECK_EQ(hass_cfg[IDS[0]], 0x03);
+    CHECK_EQ(hass_cfg[IDS[1]], 0);
+    CHECK_EQ(hass_cfg[IDS[2]], 0);
+    CHECK_EQ(hass_cfg[IDS[3]], 0);
+
+    /* labels unchanged, also no label before and after */
+    fill();
+    host_advance_ms(SNAP_INTERVAL_MS);
+    snap_job();
+    reboot();
+    CHECK(snap_restore());
+    for (size_t i = 0; i < NUM_IDS; i++)
+        CHECK_EQ(hass_cfg[IDS[i]], 0x03 + i);
+}
+
+static void test_file()
+{
+    littlefs_ok = true;
+    unsigned long filled = fill();
+    set_label(IDS[2], "sensor 2");
+    snap_save();
+    CHECK(LittleFS.exists(SNAP_FILE));
+    CHECK_EQ(LittleFS.files[SNAP_FILE].size(), SNAP_SIZE(NUM_IDS));
+    /* power loss: RTC memory is random, the file is read and removed */
+    reboot();
+    rtc_snap.magic = 0x12345678;
+    CHECK(snap_restore());
+    CHECK(restored(filled, filled));
+    for (size_t i = 0; i < NUM_IDS; i++)
+        CHECK_EQ(hass_cfg[IDS[i]], 0x03 + i);
+    CHECK(!LittleFS.exists(SNAP_FILE));
+
+    /* both valid: RTC is newer, the file is removed anyway */
+    snap_save();
+    reboot();
+    CHECK(snap_restore());
+    CHECK(!LittleFS.exists(SNAP_FILE));
+
+    /* a damaged file is not used, and removed */
+    snap_save();
+    rtc_snap.magic = 0;
+    LittleFS.files[SNAP_FILE][SNAP_HDR_SIZE + 5] ^= 0x40;
+    reboot();
+    CHECK(!snap_restore());
+    CHECK(!snap_restored);
+    CHECK(empty());
+    CHECK(!LittleFS.exists(SNAP_FILE));
+
+    /* truncated */
+    snap_save();
+    rtc_snap.magic = 0;
+    LittleFS.files[SNAP_FILE].resize(SNAP_SIZE(NUM_IDS) - 1);
+    reboot();
+    CHECK(!snap_restore());
+    CHECK(empty());
+    littlefs_ok = false;
+}
+
+/* each of magic, version and CRC is checked */
+static void test_invalid()
+{
+    for (int what = 0; what < 4; what++) {
+        fill();
+        snap_save();
+        reboot();
+        switch (what) {
+            case 0: rtc_snap.magic ^= 1; break;
+            case 1: rtc_snap.version = SNAP_VERSION - 1; break;
+            case 2: rtc_snap.entry[1].data[0] ^= 0x80; break;
+            case 3: rtc_snap.count = SENSOR_NUM + 1; break;
+        }
+        CHECK(!snap_restore());
+        CHECK(!snap_restored);
+        CHECK(empty());
+    }
+    /* nothing to restore from an empty cache */
+    memset(fcache, 0, sizeof(Cache) * SENSOR_NUM);
+    snap_save();
+    reboot();
+    CHECK(!snap_restore());
+}
+
+int main()
+{
+    host_advance_ms(123456);
+    test_rtc();
+    test_file();
+    test_invalid();
+    return test_done("snapshot");
+}
@@ -0,0 +1,130 @@
+/* automatic tuning against the simulated radio: converge, switch off and on again */
+#include "test.h"
+#include "tuning.h"
+#include "decoder.h"
+#include "radio_sim.h"
+
+static const float freq_mhz = 868.3;
+static const float datarates_kbps[] = { 9.579f, 17.241f };
+
+static SimRadio radio;
+static bool received;
+static int rate_idx;
+static int32_t rx_offset_hz;
+static float rx_bandwidth = 125.0;
+static bool afc;
+static uint32_t heard[SENSOR_NUM];
+
+static void on_packet()
+{
+    received = true;
+}
+
+/* the same steps as tuneRadio(), receive() and check_repeatedjobs() in the sketch */
+static void tune_radio(int32_t offset_hz, float bandwidth)
+{
+    rx_offset_hz = offset_hz;
+    rx_bandwidth = bandwidth;
+    radio.setFrequency((freq_mhz * 1000000.0 + offset_hz) / 1000000.0);
+    radio.setRxBandwidth(bandwidth);
+}
+
+static void run(unsigned long minutes)
+{
+    unsigned long end = millis() + minutes * 60000UL, last_switch = millis();
+    while ((long)(millis() - end) < 0) {
+        radio.poll();
+        if (received) {
+            received = false;
+            uint8_t data[FRAME_LENGTH];
+            radio.readData(data, FRAME_LENGTH);
+            SensorFrame f;
+            f.rate = rate_idx ? 17241 : 9579;
+            const Decoder *dec = decoder_find(data, FRAME_LENGTH, rate_idx);
+            if (dec && dec->TryHandleData(data, &f)) {
+                heard[f.ID]++;
+                tune_record(f.ID, rx_offset_hz + (int32_t)radio.getFrequencyError(), config.auto_tune);
+            }
+        }
+        if (millis() - last_switch > 10000) {
+            rate_idx ^= 1;
+            radio.setBitRate(datarates_kbps[rate_idx]);
+            last_switch = millis();
+        }
+        int32_t hz;
+        float bw;
+        if (config.auto_tune && tune_check(hz, bw))
+            tune_radio(hz, bw);
+        if (config.auto_tune != afc) {
+            afc = config.auto_tune;
+            if (!afc)
+                tune_radio(0, 125.0);
+            tune_reset(rx_offset_hz, rx_bandwidth);
+        }
+        host_advance_ms(100);
+    }
+}
+
+static void tuned_state(int32_t &center, float &rxbw)
+{
+    JsonDocument doc;
+    tune_json(doc.to<JsonObject>());
+    center = doc["center_offset_hz"].as<int>();
+    rxbw = doc["rxbw_khz"].as<float>();
+}
+
+/* all simulated sensors were received in the last run */
+static bool all_heard()
+{
+    bool ok = true;
+    for (size_t i = 0; i < SIM_SENSORS; i++) {
+        uint8_t ID = sim_sensors[i].id | (sim_sensors[i].rate_idx ? 0 : 0x80);
+        ok = ok && heard[ID] > 0;
+    }
+    memset(heard, 0, sizeof(heard));
+    return ok;
+}
+
+int main()
+{
+    radio.beginFSK(freq_mhz, datarates_kbps[0], 30.0, rx_bandwidth);
+    radio.setPacketReceivedAction(on_packet);
+    int32_t center;
+    float rxbw;
+
+    /* sensors from -41 to +25 kHz: centered between them, narrower filter */
+    config.auto_tune = true;
+    run(25);
+    tuned_state(center, rxbw);
+    printf("tuned: center %+d Hz, rx bandwidth %.1f kHz\n", center, rxbw);
+    CHECK(abs(center - -8000) < 2000);
+    CHECK(rxbw < 125.0);
+    CHECK_EQ(rx_offset_hz, center);
+    CHECK(rx_bandwidth == rxbw);
+    run(15);
+    CHECK(all_heard());
+
+    /* switched off: back to the defaults, and the tuning knows it */
+    config.auto_tune = false;
+    run(1);
+    CHECK_EQ(rx_offset_hz, 0);
+    CHECK(rx_bandwidth == 125.0);
+    tuned_state(center, rxbw);
+    CHECK_EQ(center, 0);
+    CHECK(rxbw == 125.0);
+    run(30);
+    CHECK_EQ(rx_offset_hz, 0);
+    CHECK(all_heard());
+
+    /* switched on again: tunes again instead of assuming the old setting is still active */
+    config.auto_tune = true;
+    run(25);
+    tuned_state(center, rxbw);
+    CHECK(abs(center - -8000) < 2000);
+    CHECK(rxbw < 125.0);
+    CHECK_EQ(rx_offset_hz, center);
+    CHECK(rx_bandwidth == rxbw);
+    run(15);
+    CHECK(all_heard());
+    return test_done("tuning");
+}
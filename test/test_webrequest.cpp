@@ -0,0 +1,308 @@
+/*
+ * Requests through guarded() with chunked responses, several in progress at
+ * once and read in chunks of different sizes while loop() changes the state
+ * they show, like the server task serving slow clients. Also the limit of
+ * responses in progress, a busy lock, clients that go away early and the
+ * JSON arenas of the requests.
+ */
+#include "test.h"
+#include "webrequest.h"
+#include "mempool.h"
+
+#define PARTS 12
+#define DOC_SENSORS 16      /* in the documents built at once, the member responses have SENSOR_NUM */
+
+static int value;           /* the shared state, changed by "loop()" */
+static int parts_rendered;
+
+/* part n of the test page, empty after the last one; the last part is larger than any chunk */
+static std::string page_text(int v, int n)
+{
+    if (n >= PARTS)
+        return "";
+    return "<p>" + std::to_string(n) + ": " + std::string(n * 300, 'a' + n) + " " + std::to_string(v) + "</p>\n";
+}
+
+/* like the pages: the handler copies what it shows, the parts are rendered from the copy */
+static void handle_page(AsyncWebServerRequest *request)
+{
+    int copy = value, n = 0;
+    send_chunked(request, "text/html", [copy, n](ChunkWriter &s) mutable -> int {
+        std::string text = page_text(copy, n++);
+        if (text.empty())
+            return WEB_PART_END;
+        parts_rendered++;
+        s += text.c_str();
+        return WEB_PART_MORE;
+    });
+}
+
+static void fill_sensor(JsonVariant s, int v, int i)
+{
+    s["value"] = v;
+    s["name"] = "sensor " + String(i);
+}
+
+static void fill_doc(JsonDocument &doc, int v, int sensors)
+{
+    for (int i = 0; i < sensors; i++)
+        fill_sensor(doc[String(i)], v, i);
+    doc["unused"]; /* read only, left as null member */
+    doc["end"] = true;
+}
+
+/* like handle_status(): the document is built under the lock */
+static void handle_json(AsyncWebServerRequest *request)
+{
+    auto json = std::make_shared<JsonDocument>(web_json_arena());
+    fill_doc(*json, value, DOC_SENSORS);
+    send_json(request, json);
+}
+
+/* like handle_api(): one sensor per part, read under the lock, every third one left out */
+static void handle_members(AsyncWebServerRequest *request)
+{
+    int i = 0;
+    send_json_members(request, [i](JsonDocument &doc, String &key) mutable -> int {
+        if (i >= SENSOR_NUM)
+            return WEB_PART_END;
+        if (!lock_state(pdMS_TO_TICKS(WEB_PART_LOCK_MS)))
+            return WEB_PART_WAIT;
+        key = String(i);
+        if (i % 3)
+            fill_sensor(doc, value, i);
+        unlock_state();
+        i++;
+        return WEB_PART_MORE;
+    });
+}
+
+/* like the sensor table: each part takes the lock itself */
+static void handle_locked_parts(AsyncWebServerRequest *request)
+{
+    int n = 0;
+    send_chunked(request, "text/plain", [n](ChunkWriter &s) mutable -> int {
+        if (n >= PARTS)
+            return WEB_PART_END;
+        if (!lock_state(pdMS_TO_TICKS(WEB_PART_LOCK_MS)))
+            return WEB_PART_WAIT;
+        s += page_text(value, n++).c_str();
+        unlock_state();
+        return WEB_PART_MORE;
+    });
+}
+
+static ArRequestHandlerFunction page = guarded(handle_page);
+static ArRequestHandlerFunction json = guarded(handle_json);
+static ArRequestHandlerFunction locked_parts = guarded(handle_locked_parts);
+static ArRequestHandlerFunction members = guarded(handle_members);
+
+struct Client {
+    AsyncWebServerRequest *request;
+    std::string expected, got;
+    size_t chunk;
+    bool done;
+};
+
+static Client start(ArRequestHandlerFunction &handler, size_t chunk)
+{
+    Client c = { new AsyncWebServerRequest, "", "", chunk, false };
+    handler(c.request);
+    return c;
+}
+
+static bool busy(Client &c)
+{
+    AsyncWebServerResponse *r = c.request->response;
+    return r && r->code == 503 && r->headers.size() == 1 && r->headers[0].first == "Retry-After";
+}
+
+/* reads one chunk, returns RESPONSE_TRY_AGAIN or the length, 0 at the end */
+static size_t pull(Client &c)
+{
+    std::vector<uint8_t> buf(c.chunk);
+    size_t n = c.request->response->fill(buf.data(), c.chunk);
+    if (n == RESPONSE_TRY_AGAIN)
+        return n;
+    CHECK(n <= c.chunk);
+    c.got.append((const char *)buf.data(), n);
+    c.done = n == 0;
+    return n;
+}
+
+static std::string expected_page(int v)
+{
+    std::string text;
+    for (int n = 0; n < PARTS; n++)
+        text += page_text(v, n);
+    return text;
+}
+
+static std::string expected_json(int v)
+{
+    JsonDocument doc;
+    fill_doc(doc, v, DOC_SENSORS);
+    return to_json(doc);
+}
+
+static std::string expected_members(int v)
+{
+    JsonDocument doc;
+    for (int i = 0; i < SENSOR_NUM; i++)
+        if (i % 3)
+            fill_sensor(doc[String(i)], v, i);
+    return to_json(doc);
+}
+
+static void finish(Client &c)
+{
+    delete c.request;
+    c.request = NULL;
+}
+
+/* all slots in use, read round robin while the state changes */
+static void test_concurrent()
+{
+    const size_t chunks[] = { 1, 7, 536, 1460 };
+    std::vector<Client> clients;
+    int pages = 0;
+    parts_rendered = 0;
+    for (int i = 0; i < WEB_MAX_PENDING; i++) {
+        pages += !(i & 1);
+        Client c = start(i & 1 ? json : page, chunks[i % 4]);
+        c.expected = i & 1 ? expected_json(value) : expected_page(value);
+        CHECK(!busy(c));
+        clients.push_back(c);
+        value++;
+    }
+
+    /* over the limit: 503, and the rejected request does not free a slot */
+    for (int i = 0; i < 2; i++) {
+        Client c = start(page, 1460);
+        CHECK(busy(c));
+        finish(c);
+    }
+
+    bool all_done = false;
+    while (!all_done) {
+        all_done = true;
+        for (Client &c : clients) {
+            if (c.done)
+                continue;
+            CHECK(pull(c) != RESPONSE_TRY_AGAIN);
+            all_done = false;
+            value++;
+        }
+    }
+    for (Client &c : clients) {
+        CHECK(c.got == c.expected);
+        CHECK_EQ(c.got.size(), c.expected.size());
+    }
+    /* every part was rendered once, however small the chunks */
+    CHECK_EQ(parts_rendered, PARTS * pages);
+
+    /* one gone: exactly one more fits */
+    finish(clients[0]);
+    Client again = start(page, 1460);
+    CHECK(!busy(again));
+    Client over = start(json, 1460);
+    CHECK(busy(over));
+    finish(over);
+    finish(again);
+    for (size_t i = 1; i < clients.size(); i++)
+        finish(clients[i]);
+    CHECK_EQ(mem_stats[MEM_WEB].in_use, 0);
+}
+
+/* clients that go away in the middle free their slot and the memory of the response */
+static void test_disconnect()
+{
+    for (int round = 0; round < 3; round++) {
+        std::vector<Client> clients;
+        for (int i = 0; i < WEB_MAX_PENDING; i++) {
+            clients.push_back(start(i & 1 ? json : page, 100));
+            CHECK(!busy(clients.back()));
+            for (int j = 0; j <= i; j++)
+                pull(clients.back());
+        }
+        CHECK(mem_stats[MEM_WEB].in_use > 0);
+        for (Client &c : clients)
+            finish(c);
+        CHECK_EQ(mem_stats[MEM_WEB].in_use, 0);
+    }
+}
+
+/* loop() holds the lock: new requests get 503, a part that needs the lock waits */
+static void test_lock_busy()
+{
+    host_state_busy = true;
+    Client c = start(page, 1460);
+    CHECK(busy(c));
+    finish(c);
+    host_state_busy = false;
+
+    Client l = start(locked_parts, 1000);
+    CHECK(!busy(l));
+    int v = value;
+    CHECK(pull(l) == 1000);
+    host_state_busy = true;
+    /* what was rendered before still goes out, then nothing until the lock is free */
+    size_t n;
+    while ((n = pull(l)) != RESPONSE_TRY_AGAIN)
+        CHECK(n > 0);
+    CHECK(pull(l) == RESPONSE_TRY_AGAIN);
+    host_state_busy = false;
+    while (!l.done)
+        CHECK(pull(l) != RESPONSE_TRY_AGAIN);
+    CHECK(l.got == expected_page(v));
+    finish(l);
+    CHECK_EQ(mem_stats[MEM_WEB].in_use, 0);
+}
+
+/*
+ * Responses overlapping all the time, so there is never a moment without a
+ * JSON document. Each request has its own arena, which is reset when its
+ * documents are gone: no heap fallbacks, however long this goes on. The
+ * state does not change here, the member responses read it as they go.
+ */
+static void test_json_arenas()
+{
+    MemStats before = mem_stats[MEM_WEB];
+    std::vector<Client> clients;
+    for (int round = 0; round < 200; round++) {
+        while ((int)clients.size() < WEB_MAX_PENDING) {
+            bool m = (round + clients.size()) % 2;
+            Client c = start(m ? members : json, 97 + 13 * clients.size());
+            CHECK(!busy(c));
+            c.expected = m ? expected_members(value) : expected_json(value);
+            clients.push_back(c);
+        }
+        for (Client &c : clients)
+            for (int j = 0; j < 3 && !c.done; j++)
+                CHECK(pull(c) != RESPONSE_TRY_AGAIN);
+        /* the finished ones go, the others keep their documents */
+        for (size_t i = 0; i < clients.size(); ) {
+            if (!clients[i].done) {
+                i++;
+                continue;
+            }
+            CHECK(clients[i].got == clients[i].expected);
+            finish(clients[i]);
+            clients.erase(clients.begin() + i);
+        }
+    }
+    for (Client &c : clients)
+        finish(c);
+    CHECK_EQ(mem_stats[MEM_WEB].fallbacks, before.fallbacks);
+    CHECK_EQ(mem_stats[MEM_WEB].in_use, 0);
+}
+
+int main()
+{
+    test_concurrent();
+    test_disconnect();
+    test_lock_busy();
+    test_json_arenas();
+    printf("webrequest: %d responses at once, peak %u bytes\n", WEB_MAX_PENDING, mem_stats[MEM_WEB].peak);
+    return test_done("webrequest");
+}
@@ -0,0 +1,68 @@
+/* Update, the flash writer used by ota.cpp, collecting the image in memory */
+#include "Update.h"
+#include <openssl/evp.h>
+
+UpdateClass Update;
+
+std::string md5_hex(const std::string &data)
+{
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+    EVP_Digest(data.data(), data.size(), md, &len, EVP_md5(), NULL);
+    std::string hex;
+    char buf[3];
+    for (unsigned int i = 0; i < len; i++) {
+        snprintf(buf, sizeof(buf), "%02x", md[i]);
+        hex += buf;
+    }
+    return hex;
+}
+
+bool UpdateClass::begin(size_t size)
+{
+    (void)size;
+    image.clear();
+    _md5.clear();
+    done = false;
+    _running = true;
+    _error = "No Error";
+    return true;
+}
+
+size_t UpdateClass::write(uint8_t *data, size_t len)
+{
+    if (!_running)
+        return 0;
+    if (fail_at && image.size() + len >= fail_at) {
+        _error = "Flash Write Failed";
+        return 0;
+    }
+    image.append((const char *)data, len);
+    return len;
+}
+
+bool UpdateClass::setMD5(const char *md5)
+{
+    _md5 = md5;
+    return true;
+}
+
+bool UpdateClass::end(bool evenIfRemaining)
+{
+    (void)evenIfRemaining;
+    if (!_running)
+        return false;
+    _running = false;
+    if (!_md5.empty() && md5_hex(image) != _md5) {
+        _error = "MD5 Check Failed";
+        return false;
+    }
+    done = true;
+    return true;
+}
+
+void UpdateClass::abort()
+{
+    _running = false;
+    _error = "Aborted";
+}
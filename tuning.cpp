@@ -0,0 +1,160 @@
+#include "tuning.h"
+
+/* do not move the center frequency for less than this */
+#define TUNE_MIN_STEP_HZ  2000
+/* samples needed before a sensor's offset is used */
+#define TUNE_MIN_SAMPLES  3
+/* keep this much distance to the filter edge */
+#define TUNE_MARGIN_KHZ   5.0
+/* FSK deviation and half the highest bit rate, see beginFSK() */
+#define TUNE_SIGNAL_KHZ   (30.0 + 17.241 / 2)
+/* revert if frames per sensor drop by more than this (percent) */
+#define TUNE_REVERT_PCT   5
+/* after a revert, wait this many intervals before trying again */
+#define TUNE_HOLDOFF      3
+
+/* receiver bandwidths supported by the SX127x, kHz */
+static const float rxbw_table[] = { 41.7, 50.0, 62.5, 83.3, 100.0, 125.0, 166.7, 200.0, 250.0 };
+#define NUM_RXBW (sizeof(rxbw_table) / sizeof(rxbw_table[0]))
+
+struct TuneSetting {
+    int32_t center_hz;
+    float rxbw_khz;
+};
+
+static int32_t off_est[SENSOR_NUM];     /* moving average, Hz */
+static uint8_t off_n[SENSOR_NUM];       /* number of samples, saturates */
+static uint16_t frames[SENSOR_NUM];     /* frames in this interval */
+static uint8_t heard_prev[SENSOR_NUM / 8];
+
+static TuneSetting cur = { 0, 125.0 };
+static TuneSetting prev;
+static float score_prev;
+static bool changed;
+static int holdoff;
+static float last_score;
+static unsigned long last_check;
+
+void tune_record(uint8_t ID, int32_t offset_hz, bool valid)
+{
+    if (frames[ID] < 0xffff)
+        frames[ID]++;
+    if (!valid)
+        return;
+    if (off_n[ID] == 0)
+        off_est[ID] = offset_hz;
+    else
+        off_est[ID] += (offset_hz - off_est[ID]) / 4;
+    if (off_n[ID] < 0xff)
+        off_n[ID]++;
+}
+
+bool tune_offset(uint8_t ID, int32_t &offset_hz)
+{
+    offset_hz = off_est[ID];
+    return off_n[ID] > 0;
+}
+
+/* frames per sensor heard in this or the last interval */
+static float interval_score()
+{
+    uint32_t total = 0;
+    int sensors = 0;
+    for (int i = 0; i < SENSOR_NUM; i++) {
+        bool prev_heard = heard_prev[i / 8] & (1 << (i % 8));
+        if (frames[i] == 0 && !prev_heard)
+            continue;
+        total += frames[i];
+        sensors++;
+    }
+    return sensors ? (float)total / sensors : 0;
+}
+
+static bool propose(TuneSetting &s)
+{
+    int32_t lo = INT32_MAX, hi = INT32_MIN;
+    for (int i = 0; i < SENSOR_NUM; i++) {
+        if (frames[i] == 0 || off_n[i] < TUNE_MIN_SAMPLES)
+            continue;
+        lo = std::min(lo, off_est[i]);
+        hi = std::max(hi, off_est[i]);
+    }
+    if (lo > hi)
+        return false;
+    s.center_hz = lo + (hi - lo) / 2;
+    float need = TUNE_SIGNAL_KHZ + (hi - lo) / 2000.0 + TUNE_MARGIN_KHZ;
+    s.rxbw_khz = rxbw_table[NUM_RXBW - 1];
+    for (int i = 0; i < NUM_RXBW; i++) {
+        if (rxbw_table[i] >= need) {
+            s.rxbw_khz = rxbw_table[i];
+            break;
+        }
+    }
+    return true;
+}
+
+/* called from loop(), returns true if the receiver needs to be set to center_hz / rxbw_khz */
+bool tune_check(int32_t &center_hz, float &rxbw_khz)
+{
+    bool ret = false;
+    unsigned long now = millis();
+    if (now - last_check < TUNE_INTERVAL_MS)
+        return false;
+    last_check = now;
+
+    float score = interval_score();
+    last_score = score;
+    TuneSetting next;
+    if (changed && score * 100 < score_prev * (100 - TUNE_REVERT_PCT)) {
+        Serial.printf("tuning: %.1f frames/sensor after change, %.1f before, reverting\r\n", score, score_prev);
+        cur = prev;
+        changed = false;
+        holdoff = TUNE_HOLDOFF;
+        ret = true;
+    } else if (holdoff > 0) {
+        holdoff--;
+        changed = false;
+    } else if (propose(next) &&
+               (abs(next.center_hz - cur.center_hz) >= TUNE_MIN_STEP_HZ || next.rxbw_khz != cur.rxbw_khz)) {
+        Serial.printf("tuning: center %+ld Hz -> %+ld Hz, rx bandwidth %.1f -> %.1f kHz\r\n",
+                      (long)cur.center_hz, (long)next.center_hz, cur.rxbw_khz, next.rxbw_khz);
+        prev = cur;
+        cur = next;
+        score_prev = score;
+        changed = true;
+        ret = true;
+    } else
+        changed = false;
+
+    for (int i = 0; i < SENSOR_NUM; i++) {
+        if (frames[i])
+            heard_prev[i / 8] |= (1 << (i % 8));
+        else
+            heard_prev[i / 8] &= ~(1 << (i % 8));
+        frames[i] = 0;
+    }
+    center_hz = cur.center_hz;
+    rxbw_khz = cur.rxbw_khz;
+    return ret;
+}
+
+void tune_reset(int32_t center_hz, float rxbw_khz)
+{
+    cur.center_hz = center_hz;
+    cur.rxbw_khz = rxbw_khz;
+    prev = cur;
+    score_prev = 0;
+    changed = false;
+    holdoff = 0;
+    /* start a new interval, frames counted while not tuning would distort the scores */
+    memset(frames, 0, sizeof(frames));
+    memset(heard_prev, 0, sizeof(heard_prev));
+    last_check = millis();
+}
+
+void tune_json(JsonObject obj)
+{
+    obj["center_offset_hz"] = cur.center_hz;
+    obj["rxbw_khz"] = cur.rxbw_khz;
+    obj["frames_per_sensor"] = last_score;
+}
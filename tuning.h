@@ -0,0 +1,26 @@
+#ifndef _TUNING_H
+#define _TUNING_H
+
+#include "Arduino.h"
+#include "globals.h"
+#include <ArduinoJson.h>
+
+/*
+ * Per sensor frequency offset estimation and automatic receiver tuning.
+ * Offsets are in Hz relative to the base frequency (freq in the main sketch),
+ * so they stay valid when the center frequency is changed.
+ * Every TUNE_INTERVAL_MS the center frequency is set to the middle of the
+ * offsets of the sensors heard and the narrowest receive bandwidth that covers
+ * all of them is selected. If the number of frames per sensor drops after a
+ * change, the previous setting is restored.
+ */
+#define TUNE_INTERVAL_MS (10 * 60 * 1000UL)
+
+void tune_record(uint8_t ID, int32_t offset_hz, bool valid);
+bool tune_check(int32_t &center_hz, float &rxbw_khz);
+/* auto tuning was switched on or off, the receiver is set to center_hz / rxbw_khz */
+void tune_reset(int32_t center_hz, float rxbw_khz);
+void tune_json(JsonObject obj);
+bool tune_offset(uint8_t ID, int32_t &offset_hz);
+
+#endif
@@ -1,7 +1,18 @@
 #include "webfrontend.h"
+#include "decoder.h"
 #include "lacrosse.h"
+#include "hass.h"
+#include "mempool.h"
+#include "boot.h"
+#include "latency.h"
+#include "ota.h"
+#include "tuning.h"
+#include "cluster.h"
+#include "labels.h"
+#include "snapshot.h"
+#include "qos.h"
+#include "webrequest.h"
 #include "globals.h"
-#include <HTTPUpdateServer.h>
 #include <LittleFS.h>
 #include <ArduinoJson.h>
 #include <esp_system.h>
@@ -12,8 +23,17 @@
 #define LACROSSE2MQTT_VERSION "unknown"
 #endif
 
-static WebServer server(80);
-static HTTPUpdateServer httpUpdater;
+/* runs in its own task (AsyncTCP), so a slow client does not block loop() */
+static AsyncWebServer server(80);
+static unsigned long restart_at;    /* restart requested by update or format */
+
+/* file system work requested by the config page, done from loop() with the state locked */
+enum {
+    WEB_IO_SAVE = 1,
+    WEB_IO_RELOAD = 2,
+    WEB_IO_FORMAT = 4
+};
+static uint8_t web_io;
 
 int name2id(const char *fname, const int start = 0)
 {
@@ -47,8 +67,14 @@ String time_string(void)
 String read_file(File &file)
 {
     String ret;
-    while (file.available())
-        ret += String((char)file.read());
+    char buf[64];
+    ret.reserve(file.size());
+    while (file.available()) {
+        size_t n = file.read((uint8_t *)buf, sizeof(buf));
+        if (n == 0)
+            break;
+        ret.concat(buf, n);
+    }
     return ret;
 }
 
@@ -66,8 +92,8 @@ bool load_idmap()
         idmapdir.close();
         return false;
     }
-    for (int i = 0; i < SENSOR_NUM; i++)
-        id2name[i] = String();
+    labels.clear();
+    hass_labels_changed();
     int found = 0;
     File file = idmapdir.openNextFile();
     while (file) {
@@ -75,8 +101,8 @@ bool load_idmap()
         int id = name2id(fname);
         if (id > -1) {
             Serial.printf("reading idmap file %s id:%2d ", fname, id);
-            id2name[id] = read_file(file);
-            Serial.println("content: " + id2name[id]);
+            labels.set(id, read_file(file));
+            Serial.println(String("content: ") + labels.get(id));
             found++;
         }
         file.close();
@@ -90,6 +116,14 @@ bool load_config()
 {
     config.display_on = true; // default
     config.ha_discovery = false; // default
+    for (int w = 0; w < AGG_WINDOWS; w++)
+        config.agg_minutes[w] = 0; // default off
+    config.payload_mode = PAYLOAD_TOPICS; // default
+    config.batch_ms = 0; // default off
+    config.auto_tune = false; // default
+    config.cluster = false; // default
+    config.qos1 = false; // default
+    config.qos_window = 8; // default
     if (!littlefs_ok)
         return false;
     File cfg = LittleFS.open("/config.json");
@@ -118,6 +152,24 @@ bool load_config()
             config.display_on = doc["display_on"];
         if (doc["ha_discovery"].is<bool>())
             config.ha_discovery = doc["ha_discovery"];
+        for (int w = 0; w < AGG_WINDOWS; w++) {
+            if (doc["agg_minutes"][w].is<uint16_t>())
+                config.agg_minutes[w] = doc["agg_minutes"][w];
+        }
+        if (doc["payload_mode"].is<uint8_t>() && doc["payload_mode"] <= PAYLOAD_MSGPACK)
+            config.payload_mode = doc["payload_mode"];
+        if (doc["batch_ms"].is<uint16_t>())
+            config.batch_ms = doc["batch_ms"];
+        if (doc["auto_tune"].is<bool>())
+            config.auto_tune = doc["auto_tune"];
+        if (doc["cluster"].is<bool>())
+            config.cluster = doc["cluster"];
+        if (doc["qos1"].is<bool>())
+            config.qos1 = doc["qos1"];
+        if (doc["qos_window"].is<uint8_t>())
+            config.qos_window = doc["qos_window"];
+        if (doc["ntp_server"].is<const char *>())
+            config.ntp_server = doc["ntp_server"].as<const char *>();
         Serial.println("result of config.json: "
                        "mqtt_server '" + config.mqtt_server + "' "
                        "mqtt_port: " + String(config.mqtt_port) + " "
@@ -151,6 +203,15 @@ bool save_config()
     doc["mqtt_pass"] = config.mqtt_pass;
     doc["display_on"] = config.display_on;
     doc["ha_discovery"] = config.ha_discovery;
+    for (int w = 0; w < AGG_WINDOWS; w++)
+        doc["agg_minutes"][w] = config.agg_minutes[w];
+    doc["payload_mode"] = config.payload_mode;
+    doc["batch_ms"] = config.batch_ms;
+    doc["ntp_server"] = config.ntp_server;
+    doc["auto_tune"] = config.auto_tune;
+    doc["cluster"] = config.cluster;
+    doc["qos1"] = config.qos1;
+    doc["qos_window"] = config.qos_window;
     if (serializeJson(doc, cfg) == 0) {
         Serial.println(F("Failed to write /config.json"));
         ret = false;
@@ -188,7 +249,7 @@ bool save_idmap()
         int id = name2id(file.name());
         String fullname = "/idmap/" + String(file.name());
         file.close();
-        if (id > -1 && id2name[id].length() == 0) {
+        if (id > -1 && !labels.has(id)) {
             Serial.print("removing ");
             Serial.println(fullname);
             if (!LittleFS.remove(fullname))
@@ -197,7 +258,7 @@ bool save_idmap()
         file = idmapdir.openNextFile();
     }
     for (int i = 0; i < SENSOR_NUM; i++) {
-        if (id2name[i].length() == 0)
+        if (!labels.has(i))
             continue;
         String fullname = String("/idmap/") + String((i < 0x10)?"0":"") + String(i, HEX);
         if (LittleFS.exists(fullname)) {
@@ -208,23 +269,23 @@ bool save_idmap()
                 String tmp = read_file(comp);
                 comp.close();
                 //Serial.print("tmp:");Serial.print(tmp);Serial.println("'");
-                //Serial.print("id2:");Serial.print(id2name[i]);Serial.println("'");
-                if (tmp == id2name[i])
+                //Serial.print("label:");Serial.print(labels.get(i));Serial.println("'");
+                if (tmp == labels.get(i))
                     continue; /* skip unchanged settings */
             }
         }
-        Serial.println("Writing file " +fullname+" content: " + id2name[i]);
+        Serial.println("Writing file " +fullname+" content: " + labels.get(i));
         File file = LittleFS.open(fullname, FILE_WRITE);
         if (! file) {
             Serial.println("file open failed :-(");
             continue;
         }
-        file.print(id2name[i]);
+        file.print(labels.get(i));
     }
     return true;
 }
 
-void add_current_table(String &s, bool rawdata)
+void add_current_table(ChunkWriter &s, bool rawdata)
 {
     String h;
     s += "<table><tr><th>ID</th><th>Temperature</th><th>Humidity</th><th>RSSI</th><th>Name</th><th>Age (ms)</th><th>Battery</th><th>New?</th>";
@@ -271,7 +332,7 @@ void add_current_table(String &s, bool rawdata)
     for (int i = 0; i < SENSOR_NUM; i++) {
         LaCrosse::Frame f;
         bool stale = false;
-        String name = id2name[i];
+        String name = labels.get(i);
         if (fcache[i].timestamp == 0) {
             if (name.length() > 0)
                 stale = true;
@@ -321,7 +382,7 @@ void add_current_table(String &s, bool rawdata)
 #endif
 }
 
-void add_header(String &s, String title)
+void add_header(ChunkWriter &s, String title)
 {
     s += "<!DOCTYPE HTML><html lang=\"en\"><head>\n"
         "<meta charset=\"utf-8\">\n"
@@ -359,119 +420,259 @@ String ESP32GetResetReason(void) {
     }
 }
 
-void add_sysinfo_footer(String &s)
+static bool config_changed = false;
+static unsigned long token;         /* of the last config page, needed to save, reload or format */
+
+/* what the pages show, copied under the lock */
+struct PageState {
+    PageState() {
+        mem_account_heap(MEM_WEB, sizeof(*this));
+        config = ::config;
+        mqtt_ok = ::mqtt_ok;
+        littlefs_ok = ::littlefs_ok;
+        config_changed = ::config_changed;
+        token = ::token;
+        uptime = time_string();
+        ota_status = ::ota_status();
+        mqtt = mqtt_stats;
+        heap_free = ESP.getFreeHeap();
+        heap_largest = ESP.getMaxAllocHeap();
+        heap_min_free = ESP.getMinFreeHeap();
+        memcpy(mem, mem_stats, sizeof(mem));
+        labels_count = labels.count();
+        labels_heap = labels.heap_size();
+        labels_used = labels.used();
+        /* compare with the String id2name[SENSOR_NUM] array used before: static objects plus one heap block per label */
+        str_heap = 0;
+        for (int i = 0; i < SENSOR_NUM; i++)
+            if (labels.has(i))
+                str_heap += labels.length(i) + 1;
+    }
+    ~PageState() {
+        mem_account_heap(MEM_WEB, -(int32_t)sizeof(*this));
+    }
+    Config config;
+    bool mqtt_ok, littlefs_ok, config_changed;
+    unsigned long token;
+    String uptime, ota_status;
+    MqttStats mqtt;
+    uint32_t heap_free, heap_largest, heap_min_free;
+    MemStats mem[MEM_SUBSYS];
+    size_t labels_count, labels_heap, labels_used, str_heap;
+};
+
+void add_sysinfo_footer(ChunkWriter &s, const PageState &p)
 {
     s += "<p>"
-        "System information: Uptime " + time_string() +
+        "System information: Uptime " + p.uptime +
         ", Software version: " + LACROSSE2MQTT_VERSION +
         ", Built: " + __DATE__ + " " + __TIME__ +
         ", Reset reason: " + ESP32GetResetReason() +
-        "</p>\n";
+        "<br>\nMQTT: " + String(p.mqtt.publishes) + " publishes, " + String(p.mqtt.bytes) + " bytes"
+        " (last minute: " + String(p.mqtt.pub_per_s, 2) + " publishes/s, " + String(p.mqtt.bytes_per_s, 1) + " bytes/s)"
+        "<br>\nHeap: free " + String(p.heap_free) +
+        ", largest block " + String(p.heap_largest) +
+        ", minimum free " + String(p.heap_min_free) +
+        ", allocations (pool fallbacks):";
+    for (int i = 0; i < MEM_SUBSYS; i++)
+        s += String(" ") + mem_subsys_name[i] + " " + String(p.mem[i].allocs) + " (" + String(p.mem[i].fallbacks) + ")";
+    s += "<br>\nLabels: " + String(p.labels_count) +
+        ", static " + String(sizeof(LabelTable)) + " bytes, heap " + String(p.labels_heap) +
+        " bytes (" + String(p.labels_used) + " used); as String array: static " + String(SENSOR_NUM * sizeof(String)) +
+        " bytes, heap at least " + String(p.str_heap) + " bytes";
+    s += "</p>\n";
 }
-void handle_api() {
+
+void handle_status(AsyncWebServerRequest *request) {
+    auto json = std::make_shared<JsonDocument>(web_json_arena());
+    JsonDocument &doc = *json;
+    doc["uptime"] = uptime_sec();
+    doc["heap"]["free"] = ESP.getFreeHeap();
+    doc["heap"]["largest_block"] = ESP.getMaxAllocHeap();
+    doc["heap"]["min_free"] = ESP.getMinFreeHeap();
+    for (int i = 0; i < MEM_SUBSYS; i++) {
+        JsonObject m = doc["alloc"][mem_subsys_name[i]].to<JsonObject>();
+        m["count"] = mem_stats[i].allocs;
+        m["fallbacks"] = mem_stats[i].fallbacks;
+        m["pool_in_use"] = mem_stats[i].in_use;
+        m["pool_peak"] = mem_stats[i].peak;
+    }
+    doc["mqtt"]["publishes"] = mqtt_stats.publishes;
+    doc["mqtt"]["bytes"] = mqtt_stats.bytes;
+    doc["mqtt"]["publishes_per_s"] = mqtt_stats.pub_per_s;
+    doc["mqtt"]["bytes_per_s"] = mqtt_stats.bytes_per_s;
+    if (config.qos1)
+        qos_json(doc["mqtt"]["qos1"].to<JsonObject>());
+    for (int i = 0; i < LAT_STAGES; i++)
+        lat_stage[i].to_json(doc["latency"][lat_stage_name[i]].to<JsonObject>());
+    doc["time_synced"] = wallclock_ok();
+    doc["radio"]["ok"] = radio_ok;
+    doc["radio"]["auto_tune"] = config.auto_tune;
+    doc["radio"]["frames_dropped"] = rxq_dropped;
+    doc["radio"]["frames_merged"] = rxq_merged;
+    tune_json(doc["radio"].as<JsonObject>());
+    if (config.cluster)
+        cluster_json(doc["cluster"].to<JsonObject>());
+    send_json(request, json);
+}
+
+void handle_boot(AsyncWebServerRequest *request) {
+    auto json = std::make_shared<JsonDocument>(web_json_arena());
+    JsonDocument &doc = *json;
+    boot_phases_json(doc);
+    send_json(request, json);
+}
+
+/* the entry of one sensor in /api/data.json, left null if there is nothing to show */
+static void sensor_json(JsonDocument &doc, int i, unsigned long now)
+{
+    SensorFrame f;
+    const char *name = labels.get(i);
+    if (fcache[i].timestamp == 0) {
+        if (labels.has(i))  // entry is stale, but configured
+            doc["name"] = name;
+        return;
+    }
+    int rate_idx;
+    if (i & 0x80) {
+        f.rate = 9579;
+        rate_idx = 0;
+    } else {
+        f.rate = 17241;
+        rate_idx = 1;
+    }
+    const Decoder *dec = decoder_find(fcache[i].data, FRAME_LENGTH, rate_idx);
+    if (! dec || ! dec->TryHandleData(fcache[i].data, &f))
+        return;
+    char tmp[2 * FRAME_LENGTH + 1];
+    if (f.humi <= 100) {
+        snprintf(tmp, sizeof(tmp), "%d%%", f.humi);
+        doc["humi"] = tmp;
+    }
+    snprintf(tmp, sizeof(tmp), "%.1f", f.temp);
+    doc["temp"] = tmp;
+    snprintf(tmp, sizeof(tmp), "%d", fcache[i].rssi);
+    doc["rssi"] = tmp;
+    doc["name"] = name;
+    doc["age"] = now - fcache[i].timestamp;
+    doc["batlo"] = f.batlo;
+    doc["init"] = f.init;
+    for (int j = 0; j < FRAME_LENGTH; j++)
+        snprintf(tmp + 2 * j, 3, "%02X", fcache[i].data[j]);
+    doc["rawdata"] = tmp;
+    int32_t offset;
+    if (tune_offset(i, offset))
+        doc["offset_hz"] = offset;
+    if (config.cluster)
+        doc["owned"] = cluster_owned(i);
+}
+
+/* one sensor per part, read under the lock when its part is rendered */
+void handle_api(AsyncWebServerRequest *request) {
     Serial.println("handle_api!");
-    JsonDocument doc;
-    unsigned long now = millis();
-    String ret;
-    for (int i = 0; i < SENSOR_NUM; i++) {
-        LaCrosse::Frame f;
-        String name = id2name[i];
-        String idx = String(i);
-        if (fcache[i].timestamp == 0) {
-            if (name.length() > 0)  // entry is stale, but configured
-                doc[idx]["name"] = name;
-            continue;
-        }
-        if (i & 0x80)
-            f.rate = 9579;
-        else
-            f.rate = 17241;
-        if (! LaCrosse::TryHandleData(fcache[i].data, &f))
-            continue;
-        if (f.humi <= 100)
-            doc[idx]["humi"] = String(f.humi) + "%";
-        doc[idx]["temp"] = String(f.temp, 1);
-        doc[idx]["rssi"] = String(fcache[i].rssi);
-        doc[idx]["name"] = name;
-        doc[idx]["age"] = now - fcache[i].timestamp;
-        doc[idx]["batlo"] = f.batlo;
-        doc[idx]["init"] = f.init;
-        String raw = "";
-        for (int j = 0; j < FRAME_LENGTH; j++) {
-            char tmp[3];
-            snprintf(tmp, 3, "%02X", fcache[i].data[j]);
-            raw += String(tmp);
-        }
-        doc[idx]["rawdata"] = raw;
+    int i = 0;
+    send_json_members(request, [i](JsonDocument &doc, String &key) mutable -> int {
+        if (i >= SENSOR_NUM)
+            return WEB_PART_END;
+        if (!lock_state(pdMS_TO_TICKS(WEB_PART_LOCK_MS)))
+            return WEB_PART_WAIT;
+        key = String(i);
+        sensor_json(doc, i, millis());
+        unlock_state();
+        i++;
+        return WEB_PART_MORE;
+    });
+}
+
+/* renders part n of a page from the snapshot, false after the last part */
+typedef bool (*PagePart)(ChunkWriter &s, const PageState &p, int n);
+
+static void send_page(AsyncWebServerRequest *request, PagePart part)
+{
+    auto p = std::make_shared<PageState>();
+    int n = 0;
+    send_chunked(request, "text/html", [p, part, n](ChunkWriter &s) mutable -> int {
+        return part(s, *p, n++) ? WEB_PART_MORE : WEB_PART_END;
+    });
+}
+
+static bool index_part(ChunkWriter &index, const PageState &p, int n)
+{
+    switch (n) {
+        case 0:
+            add_header(index, "LaCrosse2mqtt");
+            break;
+        case 1:
+            add_current_table(index, false);
+            break;
+        case 2:
+            index += "<p><a href=\"/config.html\">Configuration page</a></p>\n";
+            add_sysinfo_footer(index, p);
+            index += "</body></html>\n";
+            break;
+        default:
+            return false;
     }
-    serializeJson(doc, ret);
-    server.send(200, "application/json", ret);
+    return true;
 }
 
 //void handle_index() {
-void handle_index() {
-    // TODO: use server.hostHeader()?
+void handle_index(AsyncWebServerRequest *request) {
+    // TODO: use request->host()?
     String IP = WiFi.localIP().toString();
-    String index;
-    add_header(index, "LaCrosse2mqtt");
-    add_current_table(index, false);
-    index += "<p><a href=\"/config.html\">Configuration page</a></p>\n";
-    add_sysinfo_footer(index);
-    index += "</body></html>\n";
-    server.send(200, "text/html", index);
+    send_page(request, index_part);
 }
 
 const String on = "on";
 const String off = "off";
 const String checked = " checked=\"checked\"";
-static bool config_changed = false;
-void handle_config() {
-    static unsigned long token = millis();
-    if (server.hasArg("id") && server.hasArg("name")) {
-        String _id = server.arg("id");
-        String name = server.arg("name");
+static bool config_part(ChunkWriter &resp, const PageState &p, int n);
+
+void handle_config(AsyncWebServerRequest *request) {
+    if (request->hasArg("id") && request->hasArg("name")) {
+        String _id = request->arg("id");
+        String name = request->arg("name");
         name.trim(); /* no leading / trailing whitespace to avoid strange surprises */
         if (_id[0] >= '0' && _id[0] <= '9') {
             int id = _id.toInt();
             if (id >= 0 && id < SENSOR_NUM) {
-                id2name[id] = name;
+                labels.set(id, name);
+                hass_label_changed(id);
                 config_changed = true;
             }
         }
     }
-    if (server.hasArg("mqtt_server")) {
-        config.mqtt_server = server.arg("mqtt_server");
+    if (request->hasArg("mqtt_server")) {
+        config.mqtt_server = request->arg("mqtt_server");
         config.changed = true;
         config_changed = true;
     }
-    if (server.hasArg("mqtt_port")) {
-        String _port = server.arg("mqtt_port");
+    if (request->hasArg("mqtt_port")) {
+        String _port = request->arg("mqtt_port");
         config.mqtt_port = _port.toInt();
         config.changed = true;
         config_changed = true;
     }
-    if (server.hasArg("mqtt_user")) {
-        config.mqtt_user = server.arg("mqtt_user");
+    if (request->hasArg("mqtt_user")) {
+        config.mqtt_user = request->arg("mqtt_user");
         config.changed = true;
         config_changed = true;
     }
-    if (server.hasArg("mqtt_pass")) {
-        config.mqtt_pass = server.arg("mqtt_pass");
+    if (request->hasArg("mqtt_pass")) {
+        config.mqtt_pass = request->arg("mqtt_pass");
         config.changed = true;
         config_changed = true;
     }
-    if (server.hasArg("save")) {
-        if (server.arg("save") == String(token)) {
+    if (request->hasArg("save")) {
+        if (request->arg("save") == String(token)) {
             Serial.println("SAVE!");
-            save_idmap();
-            save_config();
+            web_io |= WEB_IO_SAVE;
             config_changed = false;
         }
     }
-    if (server.hasArg("cancel")) {
-        if (server.arg("cancel") == String(token)) {
-            load_idmap();
-            load_config();
+    if (request->hasArg("cancel")) {
+        if (request->arg("cancel") == String(token)) {
+            web_io |= WEB_IO_RELOAD;
             config_changed = false;
 #if 0
             ESP.restart();
@@ -480,105 +681,326 @@ void handle_config() {
 #endif
         }
     }
-    if (server.hasArg("format")) {
-        if (server.arg("format") == String(token)) {
-            LittleFS.begin(true);
-            ESP.restart();
-            while (true)
-                delay(100);
+    if (request->hasArg("format")) {
+        if (request->arg("format") == String(token)) {
+            web_io |= WEB_IO_FORMAT;
         }
     }
-    if (server.hasArg("display")) {
-        String _on = server.arg("display");
+    if (request->hasArg("display")) {
+        String _on = request->arg("display");
         int tmp = _on.toInt();
         if (tmp != config.display_on)
             config_changed = true;
         config.display_on = tmp;
     }
-    if (server.hasArg("ha_disc")) {
-        String _on = server.arg("ha_disc");
+    for (int w = 0; w < AGG_WINDOWS; w++) {
+        String arg = "agg" + String(w);
+        if (request->hasArg(arg.c_str())) {
+            int tmp = request->arg(arg).toInt();
+            if (tmp < 0 || tmp > 24 * 60)
+                tmp = 0;
+            if (tmp != config.agg_minutes[w])
+                config_changed = true;
+            config.agg_minutes[w] = tmp;
+        }
+    }
+    if (request->hasArg("ntp_server")) {
+        String tmp = request->arg("ntp_server");
+        tmp.trim();
+        if (tmp != config.ntp_server)
+            config_changed = true;
+        config.ntp_server = tmp;
+    }
+    if (request->hasArg("payload")) {
+        int tmp = request->arg("payload").toInt();
+        if (tmp < PAYLOAD_TOPICS || tmp > PAYLOAD_MSGPACK)
+            tmp = PAYLOAD_TOPICS;
+        if (tmp != config.payload_mode) {
+            config_changed = true;
+            hass_labels_changed(); /* battery state topic depends on it */
+        }
+        config.payload_mode = tmp;
+    }
+    if (request->hasArg("batch_ms")) {
+        int tmp = request->arg("batch_ms").toInt();
+        if (tmp < 0 || tmp > 60000)
+            tmp = 0;
+        if (tmp != config.batch_ms) {
+            config_changed = true;
+            hass_labels_changed();
+        }
+        config.batch_ms = tmp;
+    }
+    if (request->hasArg("qos1")) {
+        int tmp = request->arg("qos1").toInt();
+        if (tmp != config.qos1)
+            config_changed = true;
+        config.qos1 = tmp;
+    }
+    if (request->hasArg("qos_window")) {
+        int tmp = request->arg("qos_window").toInt();
+        if (tmp < 1 || tmp > QOS_SLOTS)
+            tmp = 8;
+        if (tmp != config.qos_window)
+            config_changed = true;
+        config.qos_window = tmp;
+    }
+    if (request->hasArg("auto_tune")) {
+        int tmp = request->arg("auto_tune").toInt();
+        if (tmp != config.auto_tune)
+            config_changed = true;
+        config.auto_tune = tmp;
+    }
+    if (request->hasArg("cluster")) {
+        int tmp = request->arg("cluster").toInt();
+        if (tmp != config.cluster) {
+            config_changed = true;
+            config.changed = true; /* reconnect with last will and subscription */
+            hass_labels_changed(); /* unique IDs depend on it */
+        }
+        config.cluster = tmp;
+    }
+    if (request->hasArg("ha_disc")) {
+        String _on = request->arg("ha_disc");
         int tmp = _on.toInt();
         if (tmp != config.ha_discovery)
             config_changed = true;
         config.ha_discovery = tmp;
     }
-    String resp;
-    add_header(resp, "LaCrosse2mqtt Configuration");
-    add_current_table(resp, true);
+    if (web_io) {
+        /* the page would show the state before loop() did the work, come back when it is done */
+        const char *what = (web_io & WEB_IO_FORMAT) ? "Formatting" : (web_io & WEB_IO_SAVE) ? "Saving" : "Reloading";
+        request->send(200, "text/html", String("<!DOCTYPE HTML><html lang=\"en\"><head>"
+                      "<meta http-equiv=\"refresh\" content=\"2; url=/config.html\"></head>\n<body>") + what + "...</body></html>\n");
+        return;
+    }
     token = millis();
-    resp += "<p>\n"
-        "<form action=\"/config.html\">\n"
-        "<table>\n"
-            " <tr>\n"
-                "<td>ID (0-255):</td><td><input type=\"number\" name=\"id\" min=\"0\" max=\"255\"></td>"
-                "<td>Name:</td><td><input name=\"name\" value=\"\"></td>"
-                "<td><button type=\"submit\">Submit</button></td>\n"
-            "</tr>\n"
-        "</table>\n"
-        "</form>\n"
-        "<p></p>\n"
-        "MQTT server configuration (Status: connection ";
-    if (!mqtt_ok)
-        resp += "NOT ";
-    resp += "ok)\n"
-        "<form action=\"/config.html\">\n"
-        "<table>\n"
-            "<tr>\n"
-                "<td>name / IP address:</td><td><input name=\"mqtt_server\" value=\"" + config.mqtt_server + "\"></td>"
-                "<td>Port:</td><td><input type=\"number\" name=\"mqtt_port\" value=\"" + String(config.mqtt_port) + "\"></td>"
-            "</tr>\n"
-            "<tr>\n"
-                "<td>Username (empty to disable):</td><td><input name=\"mqtt_user\" value=\"" + config.mqtt_user + "\"></td>"
-                "<td>Password:</td><td><input  name=\"mqtt_pass\" value=\"" + String(config.mqtt_pass) + "\"></td>"
-                "<td><button type=\"submit\">Submit</button></td>\n"
-            "</tr>\n"
-        "</table>\n"
-        "</form>\n";
-    if (config_changed) {
-        resp += "<p></p>\nConfig changed, please save or reload old config.\n"
-            "<table>\n<tr>\n<td>"
-            "<form action=\"/config.html\">"
-            "<input type=\"hidden\" name=\"save\" value=\"" + String(token) + "\"><button type=\"submit\">Save</button>"
-            "</form></td>\n<td>"
-            "<form action=\"/config.html\">"
-            "<input type=\"hidden\" name=\"cancel\" value=\"" + String(token) + "\"><button type=\"submit\">Reload</button>"
-            "</form></td>\n</tr>\n</table>\n";
-    }
-    if (!littlefs_ok) {
-        resp += "<p></p>\n"
-            "<form action=\"/config.html\">"
-            "<strong>LittleFS seems damaged. Saving will not work.</strong> Format it? "
-            "<input type=\"hidden\" name=\"format\" value=\"" + String(token) + "\"><button type=\"submit\">Yes, format!</button>"
-            "</form>\n";
-    }
-    resp += "<p></p>\n"
-            "<form action=\"/config.html\">"
+    send_page(request, config_part);
+}
+
+static bool config_part(ChunkWriter &resp, const PageState &p, int n)
+{
+    static const char * const payload_names[] = { "one topic per value", "JSON", "MessagePack" };
+    switch (n) {
+        case 0:
+            add_header(resp, "LaCrosse2mqtt Configuration");
+            break;
+        case 1:
+            add_current_table(resp, true);
+            break;
+        case 2:
+            resp += "<p>\n"
+                "<form action=\"/config.html\">\n"
+                "<table>\n"
+                    " <tr>\n"
+                        "<td>ID (0-255):</td><td><input type=\"number\" name=\"id\" min=\"0\" max=\"255\"></td>"
+                        "<td>Name:</td><td><input name=\"name\" value=\"\"></td>"
+                        "<td><button type=\"submit\">Submit</button></td>\n"
+                    "</tr>\n"
+                "</table>\n"
+                "</form>\n"
+                "<p></p>\n"
+                "MQTT server configuration (Status: connection ";
+            if (!p.mqtt_ok)
+                resp += "NOT ";
+            resp += "ok)\n"
+                "<form action=\"/config.html\">\n"
+                "<table>\n"
+                    "<tr>\n"
+                        "<td>name / IP address:</td><td><input name=\"mqtt_server\" value=\"" + p.config.mqtt_server + "\"></td>"
+                        "<td>Port:</td><td><input type=\"number\" name=\"mqtt_port\" value=\"" + String(p.config.mqtt_port) + "\"></td>"
+                    "</tr>\n"
+                    "<tr>\n"
+                        "<td>Username (empty to disable):</td><td><input name=\"mqtt_user\" value=\"" + p.config.mqtt_user + "\"></td>"
+                        "<td>Password:</td><td><input  name=\"mqtt_pass\" value=\"" + String(p.config.mqtt_pass) + "\"></td>"
+                        "<td><button type=\"submit\">Submit</button></td>\n"
+                    "</tr>\n"
+                "</table>\n"
+                "</form>\n";
+            if (p.config_changed) {
+                resp += "<p></p>\nConfig changed, please save or reload old config.\n"
+                    "<table>\n<tr>\n<td>"
+                    "<form action=\"/config.html\">"
+                    "<input type=\"hidden\" name=\"save\" value=\"" + String(p.token) + "\"><button type=\"submit\">Save</button>"
+                    "</form></td>\n<td>"
+                    "<form action=\"/config.html\">"
+                    "<input type=\"hidden\" name=\"cancel\" value=\"" + String(p.token) + "\"><button type=\"submit\">Reload</button>"
+                    "</form></td>\n</tr>\n</table>\n";
+            }
+            if (!p.littlefs_ok) {
+                resp += "<p></p>\n"
+                    "<form action=\"/config.html\">"
+                    "<strong>LittleFS seems damaged. Saving will not work.</strong> Format it? "
+                    "<input type=\"hidden\" name=\"format\" value=\"" + String(p.token) + "\"><button type=\"submit\">Yes, format!</button>"
+                    "</form>\n";
+            }
+            break;
+        case 3:
+            resp += "<p></p>\n"
+                    "<form action=\"/config.html\">"
 #if 0
-            "Display is default <b>" + (config.display_on ? on : off) + "</b>."
-            "<input type=\"hidden\" name=\"display\" value=\"" + String(!config.display_on) +
-            "\"><button type=\"submit\">Switch to default " + (config.display_on ? off : on) + "</button>"
+                    "Display is default <b>" + (p.config.display_on ? on : off) + "</b>."
+                    "<input type=\"hidden\" name=\"display\" value=\"" + String(!p.config.display_on) +
+                    "\"><button type=\"submit\">Switch to default " + (p.config.display_on ? off : on) + "</button>"
 #endif
-            "<table><tr>"
-            "<td>Display is default</td>"
-            "<td><input type=\"radio\" id=\"d_on\" name=\"display\" value=\"1\" " + (config.display_on?checked:String()) + "/>"
-            "<label for=\"d_on\">on</label></td>"
-            "<td><input type=\"radio\" id=\"d_off\" name=\"display\" value=\"0\"" + (config.display_on?String():checked) + "/>"
-            "<label for=\"d_off\">off</label></td>"
-            "<td><button type=\"submit\">Submit</button></td>"
-            "</tr><tr>"
-            "<td>Home Assistant discovery</td>"
-            "<td><input type=\"radio\" id=\"ha_on\" name=\"ha_disc\" value=\"1\" " + (config.ha_discovery?checked:String()) + "/>"
-            "<label for=\"ha_on\">on</label></td>"
-            "<td><input type=\"radio\" id=\"ha_off\" name=\"ha_disc\" value=\"0\"" + (config.ha_discovery?String():checked) + "/>"
-            "<label for=\"ha_off\">off</label></td>"
-            "<td><button type=\"submit\">Submit</button></td>"
-            "</tr></table>"
-            "</form>\n";
-    resp += "<p><a href=\"/update\">Update software</a></p>\n"
-            "<p><a href=\"/\">Main page</a></p>\n";
-    add_sysinfo_footer(resp);
-    resp += "</body></html>\n";
-    server.send(200, "text/html", resp);
+                    "<table><tr>"
+                    "<td>Display is default</td>"
+                    "<td><input type=\"radio\" id=\"d_on\" name=\"display\" value=\"1\" " + (p.config.display_on?checked:String()) + "/>"
+                    "<label for=\"d_on\">on</label></td>"
+                    "<td><input type=\"radio\" id=\"d_off\" name=\"display\" value=\"0\"" + (p.config.display_on?String():checked) + "/>"
+                    "<label for=\"d_off\">off</label></td>"
+                    "<td><button type=\"submit\">Submit</button></td>"
+                    "</tr><tr>"
+                    "<td>Home Assistant discovery</td>"
+                    "<td><input type=\"radio\" id=\"ha_on\" name=\"ha_disc\" value=\"1\" " + (p.config.ha_discovery?checked:String()) + "/>"
+                    "<label for=\"ha_on\">on</label></td>"
+                    "<td><input type=\"radio\" id=\"ha_off\" name=\"ha_disc\" value=\"0\"" + (p.config.ha_discovery?String():checked) + "/>"
+                    "<label for=\"ha_off\">off</label></td>"
+                    "<td><button type=\"submit\">Submit</button></td>"
+                    "</tr><tr>"
+                    "<td>Automatic frequency tuning</td>"
+                    "<td><input type=\"radio\" id=\"at_on\" name=\"auto_tune\" value=\"1\" " + (p.config.auto_tune?checked:String()) + "/>"
+                    "<label for=\"at_on\">on</label></td>"
+                    "<td><input type=\"radio\" id=\"at_off\" name=\"auto_tune\" value=\"0\"" + (p.config.auto_tune?String():checked) + "/>"
+                    "<label for=\"at_off\">off</label></td>"
+                    "<td><button type=\"submit\">Submit</button></td>"
+                    "</tr><tr>"
+                    "<td>Cluster mode (several gateways)</td>"
+                    "<td><input type=\"radio\" id=\"cl_on\" name=\"cluster\" value=\"1\" " + (p.config.cluster?checked:String()) + "/>"
+                    "<label for=\"cl_on\">on</label></td>"
+                    "<td><input type=\"radio\" id=\"cl_off\" name=\"cluster\" value=\"0\"" + (p.config.cluster?String():checked) + "/>"
+                    "<label for=\"cl_off\">off</label></td>"
+                    "<td><button type=\"submit\">Submit</button></td>"
+                    "</tr></table>"
+                    "</form>\n";
+            break;
+        case 4:
+            resp += "<p></p>\n"
+                    "<form action=\"/config.html\">"
+                    "<table><tr>"
+                    "<td>MQTT payload format</td>";
+            for (int i = PAYLOAD_TOPICS; i <= PAYLOAD_MSGPACK; i++)
+                resp += "<td><input type=\"radio\" id=\"p" + String(i) + "\" name=\"payload\" value=\"" + String(i) + "\"" +
+                        (p.config.payload_mode == i ? checked : String()) + "/>"
+                        "<label for=\"p" + String(i) + "\">" + payload_names[i] + "</label></td>";
+            resp += "</tr><tr>"
+                    "<td>Batch interval (ms, 0 = off)</td>"
+                    "<td><input type=\"number\" name=\"batch_ms\" min=\"0\" max=\"60000\" value=\"" + String(p.config.batch_ms) + "\"></td>"
+                    "<td><button type=\"submit\">Submit</button></td>"
+                    "</tr><tr>"
+                    "<td>Sensor data with QoS 1</td>"
+                    "<td><input type=\"radio\" id=\"q_on\" name=\"qos1\" value=\"1\" " + (p.config.qos1?checked:String()) + "/>"
+                    "<label for=\"q_on\">on</label></td>"
+                    "<td><input type=\"radio\" id=\"q_off\" name=\"qos1\" value=\"0\"" + (p.config.qos1?String():checked) + "/>"
+                    "<label for=\"q_off\">off</label></td>"
+                    "</tr><tr>"
+                    "<td>Messages in flight (1-" + String(QOS_SLOTS) + ")</td>"
+                    "<td><input type=\"number\" name=\"qos_window\" min=\"1\" max=\"" + String(QOS_SLOTS) + "\" value=\"" + String(p.config.qos_window) + "\"></td>"
+                    "<td><button type=\"submit\">Submit</button></td>"
+                    "</tr></table>"
+                    "</form>\n";
+            break;
+        case 5:
+            resp += "<p></p>\n"
+                    "<form action=\"/config.html\">"
+                    "<table><tr>"
+                    "<td>NTP server (empty to disable, restart to stop time sync)</td>"
+                    "<td><input name=\"ntp_server\" value=\"" + p.config.ntp_server + "\"></td>"
+                    "<td><button type=\"submit\">Submit</button></td>"
+                    "</tr></table>"
+                    "</form>\n";
+            resp += "<p></p>\n"
+                    "<form action=\"/config.html\">"
+                    "<table><tr>"
+                    "<td>Aggregation windows (minutes, 0 = off)</td>";
+            for (int w = 0; w < AGG_WINDOWS; w++)
+                resp += "<td><input type=\"number\" name=\"agg" + String(w) + "\" min=\"0\" max=\"1440\" value=\"" +
+                        String(p.config.agg_minutes[w]) + "\"></td>";
+            resp += "<td><button type=\"submit\">Submit</button></td>"
+                    "</tr></table>"
+                    "</form>\n";
+            break;
+        case 6:
+            resp += "<p><a href=\"/update\">Update software</a></p>\n"
+                    "<p><a href=\"/\">Main page</a></p>\n";
+            add_sysinfo_footer(resp, p);
+            resp += "</body></html>\n";
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+static bool update_part(ChunkWriter &resp, const PageState &p, int n)
+{
+    switch (n) {
+        case 0:
+            add_header(resp, "LaCrosse2mqtt Software Update");
+            break;
+        case 1:
+            resp += "<form method=\"POST\" action=\"/update\" enctype=\"multipart/form-data\" "
+                    "onsubmit=\"if(this.md5.value)this.action='/update?md5='+this.md5.value\">\n"
+                    "<table>\n"
+                    "<tr><td>Firmware image (.bin, .bin.gz):</td><td><input type=\"file\" name=\"image\"></td></tr>\n"
+                    "<tr><td>MD5 of the uncompressed image (required for .gz):</td><td><input name=\"md5\" size=\"34\"></td></tr>\n"
+                    "<tr><td></td><td><button type=\"submit\">Update</button></td></tr>\n"
+                    "</table>\n"
+                    "</form>\n";
+            if (p.ota_status.length() > 0)
+                resp += "<p>Last update: " + p.ota_status + "</p>\n";
+            resp += "<p><a href=\"/config.html\">Configuration page</a></p>\n";
+            add_sysinfo_footer(resp, p);
+            resp += "</body></html>\n";
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+void handle_update_page(AsyncWebServerRequest *request) {
+    send_page(request, update_part);
+}
+
+static bool update_ok = false;
+static AsyncWebServerRequest *ota_request; /* the upload in progress */
+void handle_update_done(AsyncWebServerRequest *request) {
+    if (ota_request != request) {
+        request->send(409, "text/plain", "Another update is in progress.\n");
+        return;
+    }
+    bool ok = update_ok;
+    update_ok = false;
+    ota_request = NULL;
+    AsyncWebServerResponse *resp = request->beginResponse(ok ? 200 : 500, "text/plain", ota_status() + "\n");
+    resp->addHeader("Connection", "close");
+    request->send(resp);
+    if (ok)
+        restart_at = millis(); /* from loop(), after the response is sent */
+}
+
+/* the upload is not locked against loop(), it does not touch shared state */
+void handle_update_upload(AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t len, bool final) {
+    if (index == 0) {
+        if (ota_request)
+            return; /* only one at a time, rejected in handle_update_done() */
+        Serial.println("Update: " + filename);
+        ota_request = request;
+        update_ok = false;
+        request->onDisconnect([request]() {
+            if (ota_request == request) {
+                ota_abort();
+                ota_request = NULL;
+            }
+        });
+        ota_begin(request->hasArg("md5") ? request->arg("md5") : String());
+    }
+    if (ota_request != request)
+        return;
+    ota_write(data, len);
+    if (final)
+        update_ok = ota_end();
 }
 
 void setup_web()
@@ -587,19 +1009,50 @@ void setup_web()
         Serial.println("setup_web ERROR: load_idmap() failed?");
     if (!load_config())
         Serial.println("setup_web ERROR: load_config() failed?");
-    server.on("/", handle_index);
-    server.on("/index.html", handle_index);
-    server.on("/config.html", handle_config);
-    server.on("/api/data.json", handle_api);
-    server.onNotFound([](){
-        server.send(404, "text/plain", "The content you are looking for was not found.\n");
-        Serial.println("404: " + server.uri());
+    server.on("/", HTTP_GET, guarded(handle_index));
+    server.on("/index.html", HTTP_GET, guarded(handle_index));
+    server.on("/config.html", HTTP_GET, guarded(handle_config));
+    server.on("/api/data.json", HTTP_GET, guarded(handle_api));
+    server.on("/api/status.json", HTTP_GET, guarded(handle_status));
+    server.on("/api/boot", HTTP_GET, guarded(handle_boot));
+    server.onNotFound([](AsyncWebServerRequest *request) {
+        request->send(404, "text/plain", "The content you are looking for was not found.\n");
+        Serial.println("404: " + request->url());
     });
-    httpUpdater.setup(&server);
+    server.on("/update", HTTP_GET, guarded(handle_update_page));
+    server.on("/update", HTTP_POST, handle_update_done, handle_update_upload);
+}
+
+/* requests are served from now on */
+void start_web()
+{
     server.begin();
 }
 
-void handle_client()
+/* called from loop() */
+void web_job()
 {
-    server.handleClient();
+    if (web_io) {
+        lock_state();
+        uint8_t io = web_io;
+        web_io = 0;
+        if (io & WEB_IO_SAVE) {
+            save_idmap();
+            save_config();
+        }
+        if (io & WEB_IO_RELOAD) {
+            load_idmap();
+            load_config();
+        }
+        if (io & WEB_IO_FORMAT) {
+            LittleFS.begin(true);
+            restart_at = millis();
+        }
+        unlock_state();
+    }
+    if (restart_at && millis() - restart_at > 500) {
+        lock_state(); /* not released again */
+        snap_save();
+        ESP.restart();
+    }
 }
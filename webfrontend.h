@@ -2,7 +2,6 @@
 #define _WEBFRONTEND_H
 
 void setup_web();
-void handle_index();
-void handle_config();
-void handle_client();
+void start_web();
+void web_job();
 #endif
@@ -0,0 +1,179 @@
+#include "webrequest.h"
+#include "mempool.h"
+#include "globals.h"
+
+/* a response in progress */
+struct WebSlot {
+    WebSlot() : pool(mem, sizeof(mem), MEM_WEB), used(false) {}
+    uint8_t mem[WEB_JSON_POOL_SIZE] __attribute__((aligned(8)));
+    JsonPool pool;
+    bool used;
+};
+
+/* only touched from the server task */
+static WebSlot web_slot[WEB_MAX_PENDING];
+static WebSlot *cur_slot;   /* of the handler running in guarded() */
+
+size_t ChunkWriter::write(const uint8_t *data, size_t size)
+{
+    size_t n = std::min(size, _len - _n);
+    memcpy(_buf + _n, data, n);
+    _n += n;
+    if (n < size)
+        _rest.concat((const char *)data + n, size - n);
+    return size;
+}
+
+/* one response in progress, lives as long as the server keeps the filler */
+struct ChunkedResponse {
+    ChunkedResponse(PartRenderer r) : render(r), sent(0), end(false) {
+        mem_account_heap(MEM_WEB, sizeof(*this));
+    }
+    ~ChunkedResponse() {
+        mem_account_heap(MEM_WEB, -(int32_t)(sizeof(*this) + rest.length()));
+    }
+    size_t fill(uint8_t *buf, size_t len);
+    PartRenderer render;
+    String rest;    /* rendered, but did not fit into the last chunk */
+    size_t sent;    /* bytes of rest already sent */
+    bool end;
+};
+
+size_t ChunkedResponse::fill(uint8_t *buf, size_t len)
+{
+    size_t n = std::min(len, rest.length() - sent);
+    memcpy(buf, rest.c_str() + sent, n);
+    sent += n;
+    if (sent < rest.length())
+        return n;
+    if (rest.length())
+        mem_account_heap(MEM_WEB, -(int32_t)rest.length());
+    rest = String();
+    sent = 0;
+    ChunkWriter w(buf + n, len - n, rest);
+    int ret = WEB_PART_MORE;
+    while (!end && !w.full()) {
+        ret = render(w);
+        if (ret == WEB_PART_END)
+            end = true;
+        else if (ret == WEB_PART_WAIT)
+            break;
+    }
+    if (rest.length())
+        mem_account_heap(MEM_WEB, rest.length());
+    n += w.length();
+    if (n == 0 && ret == WEB_PART_WAIT)
+        return RESPONSE_TRY_AGAIN;
+    return n; /* 0 ends the response */
+}
+
+void send_busy(AsyncWebServerRequest *request)
+{
+    AsyncWebServerResponse *resp = request->beginResponse(503, "text/plain", "Busy, please try again.\n");
+    resp->addHeader("Retry-After", "1");
+    request->send(resp);
+}
+
+void send_chunked(AsyncWebServerRequest *request, const char *type, PartRenderer render)
+{
+    auto resp = std::make_shared<ChunkedResponse>(render);
+    request->send(request->beginChunkedResponse(type, [resp](uint8_t *buf, size_t len, size_t) -> size_t {
+        return resp->fill(buf, len);
+    }));
+}
+
+void send_json(AsyncWebServerRequest *request, std::shared_ptr<JsonDocument> json)
+{
+    JsonObject obj = json->as<JsonObject>();
+    JsonObject::iterator it = obj.begin();
+    bool opened = false, closed = false, first = true;
+    send_chunked(request, "application/json", [json, obj, it, opened, closed, first](ChunkWriter &w) mutable -> int {
+        if (!opened) {
+            opened = true;
+            w += "{";
+            return WEB_PART_MORE;
+        }
+        if (it != obj.end()) {
+            if (!first)
+                w += ",";
+            first = false;
+            /* the keys are our own names and sensor IDs, nothing to escape */
+            w += "\"";
+            w += it->key().c_str();
+            w += "\":";
+            JsonVariant value = it->value();
+            serializeJson(value, w);
+            ++it;
+            return WEB_PART_MORE;
+        }
+        if (closed)
+            return WEB_PART_END;
+        closed = true;
+        w += "}";
+        return WEB_PART_MORE;
+    });
+}
+
+void send_json_members(AsyncWebServerRequest *request, JsonMemberRenderer render)
+{
+    JsonPool *pool = web_json_arena();
+    bool opened = false, closed = false, first = true;
+    send_chunked(request, "application/json", [pool, render, opened, closed, first](ChunkWriter &w) mutable -> int {
+        if (!opened) {
+            opened = true;
+            w += "{";
+            return WEB_PART_MORE;
+        }
+        if (closed)
+            return WEB_PART_END;
+        JsonDocument doc(pool);
+        String key;
+        int ret = render(doc, key);
+        if (ret == WEB_PART_WAIT)
+            return ret;
+        if (ret == WEB_PART_END) {
+            closed = true;
+            w += "}";
+            return WEB_PART_MORE;
+        }
+        if (doc.isNull())
+            return WEB_PART_MORE;
+        if (!first)
+            w += ",";
+        first = false;
+        w += "\"";
+        w += key;
+        w += "\":";
+        serializeJson(doc, w);
+        return WEB_PART_MORE;
+    });
+}
+
+JsonPool *web_json_arena()
+{
+    return &cur_slot->pool;
+}
+
+ArRequestHandlerFunction guarded(void (*fn)(AsyncWebServerRequest *))
+{
+    return [fn](AsyncWebServerRequest *request) {
+        WebSlot *slot = NULL;
+        for (WebSlot &s : web_slot) {
+            if (!s.used) {
+                slot = &s;
+                break;
+            }
+        }
+        if (!slot || !lock_state(pdMS_TO_TICKS(WEB_LOCK_MS))) {
+            send_busy(request);
+            return;
+        }
+        slot->used = true;
+        /* the library deletes the response right after this, with the documents in the arena */
+        request->onDisconnect([slot]() { slot->used = false; });
+        cur_slot = slot;
+        fn(request);
+        cur_slot = NULL;
+        unlock_state();
+    };
+}
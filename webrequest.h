@@ -0,0 +1,97 @@
+#ifndef _WEBREQUEST_H
+#define _WEBREQUEST_H
+
+#include "Arduino.h"
+#include <ESPAsyncWebServer.h>
+#include <ArduinoJson.h>
+#include "mempool.h"
+#include <functional>
+#include <memory>
+
+/*
+ * Request limits and chunked responses for the web frontend. A response is
+ * rendered part by part as the client acknowledges the previous chunk: each
+ * part is rendered once, straight into the chunk buffer of the connection,
+ * only what does not fit is kept until the next chunk. So a connection holds
+ * at most one part besides what its renderer captured.
+ */
+
+/* wait at most this long for loop() to release the shared state */
+#define WEB_LOCK_MS 200
+/* a part renderer that needs the shared state waits only this long, then the chunk is retried */
+#define WEB_PART_LOCK_MS 20
+/* responses in progress at the same time, more requests are answered with 503 */
+#define WEB_MAX_PENDING 4
+/* JSON arena of each of them, the largest document is /api/status.json with all cluster peers */
+#define WEB_JSON_POOL_SIZE 4096
+
+/* collects the output of a part: into the chunk buffer as long as there is room, the rest into a String */
+class ChunkWriter : public Print {
+public:
+    ChunkWriter(uint8_t *buf, size_t len, String &rest) : _buf(buf), _len(len), _n(0), _rest(rest) {}
+    size_t write(uint8_t c) override {
+        return write(&c, 1);
+    }
+    size_t write(const uint8_t *data, size_t size) override;
+    ChunkWriter &operator+=(const String &str) {
+        write((const uint8_t *)str.c_str(), str.length());
+        return *this;
+    }
+    ChunkWriter &operator+=(const char *str) {
+        write((const uint8_t *)str, strlen(str));
+        return *this;
+    }
+    /* bytes in the chunk buffer */
+    size_t length() const {
+        return _n;
+    }
+    bool full() const {
+        return _n == _len;
+    }
+private:
+    uint8_t *_buf;
+    size_t _len, _n;
+    String &_rest;
+};
+
+/* result of a part renderer */
+enum {
+    WEB_PART_END,   /* nothing written, there are no more parts */
+    WEB_PART_MORE,  /* part written, call again for the next one */
+    WEB_PART_WAIT   /* nothing written, the shared state is busy, call again later */
+};
+
+/*
+ * Renders the next part of a response and keeps track of its position itself.
+ * Runs in the server task without the lock, so it may only read what the
+ * handler copied, or take the lock for the part with WEB_PART_LOCK_MS.
+ */
+typedef std::function<int(ChunkWriter &)> PartRenderer;
+
+void send_busy(AsyncWebServerRequest *request);
+void send_chunked(AsyncWebServerRequest *request, const char *type, PartRenderer render);
+/* the document is built under the lock, serialized one top level member per part after it is released */
+void send_json(AsyncWebServerRequest *request, std::shared_ptr<JsonDocument> json);
+
+/*
+ * Renders the next member of a JSON object: sets its key and builds its
+ * value in doc. Returns like a PartRenderer, members left null are skipped.
+ */
+typedef std::function<int(JsonDocument &doc, String &key)> JsonMemberRenderer;
+/* a JSON object too big for one document, one member per part in its own document */
+void send_json_members(AsyncWebServerRequest *request, JsonMemberRenderer render);
+
+/*
+ * The JSON arena of the request being handled, only valid in handlers run by
+ * guarded(). It is reset when the documents of that request are released, so
+ * one slow client does not keep the others from reusing theirs.
+ */
+JsonPool *web_json_arena();
+
+/*
+ * Runs fn with the shared state locked, or answers 503 if the lock is not
+ * free within WEB_LOCK_MS or WEB_MAX_PENDING responses are in progress.
+ */
+ArRequestHandlerFunction guarded(void (*fn)(AsyncWebServerRequest *));
+
+#endif